@@ -1,6 +1,8 @@
 SET InputPath=%1
 SET OutputPath=%2
+REM optional define of a shader variant, e.g. -DNO_DETAIL
+SET Defines=%3
 
 echo hello
-echo %VK_SDK_PATH%\Bin\glslangValidator.exe -V %InputPath% -o %OutputPath%.spv.bin
-%VK_SDK_PATH%\Bin\glslangValidator.exe -V %InputPath% -o %OutputPath%.spv.bin
+echo %VK_SDK_PATH%\Bin\glslangValidator.exe -V %Defines% %InputPath% -o %OutputPath%.spv.bin
+%VK_SDK_PATH%\Bin\glslangValidator.exe -V %Defines% %InputPath% -o %OutputPath%.spv.bin
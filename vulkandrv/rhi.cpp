@@ -4,6 +4,7 @@
 #include <cassert>
 
 IRHIGraphicsPipeline::~IRHIGraphicsPipeline() {}
+IRHIComputePipeline::~IRHIComputePipeline() {}
 IRHICmdBuf::~IRHICmdBuf() {}
 IRHIRenderPass::~IRHIRenderPass() {}
 IRHIFrameBuffer::~IRHIFrameBuffer() {}
@@ -12,6 +13,7 @@ IRHIShader::~IRHIShader() {}
 IRHIBuffer::~IRHIBuffer() {}
 IRHIFence::~IRHIFence() {}
 IRHIEvent::~IRHIEvent() {}
+IRHIQueryPool::~IRHIQueryPool() {}
 IRHIImageView::~IRHIImageView() {}
 IRHISampler::~IRHISampler() {}
 IRHIDescriptorSetLayout::~IRHIDescriptorSetLayout() {}
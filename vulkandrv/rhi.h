@@ -9,9 +9,11 @@ class IRHIDevice;
 class IRHIImageView;
 class IRHIImage;
 class IRHIGraphicsPipeline;
+class IRHIComputePipeline;
 class IRHIRenderPass;
 class IRHIFrameBuffer;
 class IRHIEvent;
+class IRHIQueryPool;
 
 typedef uint32_t RHIFlags;
 
@@ -68,6 +70,17 @@ enum class RHIFormat : uint32_t {
     kD32_SFLOAT,
     kD32_SFLOAT_S8_UINT,
 
+	// block compressed (S3TC), 4x4 blocks
+	kBC1_RGBA_UNORM,
+	kBC1_RGBA_SRGB,
+	kBC2_UNORM,
+	kBC2_SRGB,
+	kBC3_UNORM,
+	kBC3_SRGB,
+
+	kR8_UINT,
+
+	kCount
 };
 #else
 #define RHIFormat VkFormat
@@ -405,7 +418,8 @@ struct RHIBufferUsageFlagBits { enum: uint32_t {
     kUniformBufferBit = 0x00000010,
     kStorageBufferBit = 0x00000020,
     kIndexBufferBit = 0x00000040,
-    kVertexBufferBit = 0x00000080
+    kVertexBufferBit = 0x00000080,
+    kIndirectBufferBit = 0x00000100
 };
 };
 typedef RHIFlags RHIBufferUsageFlags;
@@ -457,6 +471,14 @@ enum : uint32_t {
 ////////////////////////////////////////////////////////////////////////////////
 struct RHIPhysDeviceProperties {
     uint32_t minUniformBufferOffsetAlignment;
+    // drawCount > 1 in DrawIndexedIndirect
+    bool multiDrawIndirect;
+    // RHIPrimitiveTopology::kTriangleFan is available
+    bool triangleFans;
+    // nanoseconds per timestamp tick, 0 if graphics queue does not support timestamps
+    float timestampPeriod;
+    // kBC* formats can be sampled
+    bool textureCompressionBC;
     //...
 };
 
@@ -664,6 +686,26 @@ struct RHIScissor {
 	int32_t height;
 };
 
+// same layout as VkDrawIndexedIndirectCommand
+struct RHIDrawIndexedIndirectCommand {
+	uint32_t indexCount;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+};
+
+// one mip level of a buffer to 2D image copy, rows in the buffer are tightly packed
+struct RHIBufferImageCopy {
+	uint32_t bufferOffset;
+	uint32_t mipLevel;
+	uint32_t width;
+	uint32_t height;
+	// offset of the region in the image
+	int32_t x;
+	int32_t y;
+};
+
 struct RHIShaderStage {
 	RHIShaderStageFlagBits::Value stage;
 	class IRHIShader *module;
@@ -788,14 +830,21 @@ public:
 	virtual bool BeginRenderPass(IRHIRenderPass *i_rp, IRHIFrameBuffer *i_fb, const ivec4 *render_area,
 					   const RHIClearValue *clear_values, uint32_t count) = 0;
 	virtual void BindPipeline(RHIPipelineBindPoint::Value bind_point, IRHIGraphicsPipeline* pipeline) = 0;
+	virtual void BindComputePipeline(IRHIComputePipeline* pipeline) = 0;
 	virtual void BindDescriptorSets(RHIPipelineBindPoint::Value bind_point,
 									const class IRHIPipelineLayout* pipeline_layout,
 									const class IRHIDescriptorSet *const *desc_sets, uint32_t count,
 									uint32_t dyn_offsets_count, const uint32_t* dyn_offsets) = 0;
 	virtual void Draw(uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex,
 					  uint32_t first_instance) = 0;
+	// outside of render pass only
+	virtual void Dispatch(uint32_t group_count_x, uint32_t group_count_y,
+						  uint32_t group_count_z) = 0;
 	virtual void DrawIndexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index,
 							 uint32_t vertex_offset, uint32_t first_instance) = 0;
+	// buffer contains RHIDrawIndexedIndirectCommand structures
+	virtual void DrawIndexedIndirect(class IRHIBuffer *i_buf, uint32_t offset, uint32_t draw_count,
+									 uint32_t stride) = 0;
 
     virtual void BindVertexBuffers(class IRHIBuffer** i_vb, uint32_t first_binding, uint32_t count) = 0;
     virtual void BindIndexBuffer(class IRHIBuffer* i_ib, uint32_t offset, RHIIndexType type) = 0;
@@ -804,6 +853,13 @@ public:
 							uint32_t src_offset, uint32_t size) = 0;
 
     virtual void CopyBufferToImage2D(class IRHIImage *i_dst, class IRHIBuffer *i_src) = 0;
+	// copies several mip levels at once, image should be in transfer dst layout
+	virtual void CopyBufferToImage2D(class IRHIImage *i_dst, class IRHIBuffer *i_src,
+									 const RHIBufferImageCopy *regions, uint32_t count) = 0;
+	// fills mips [first_level, numMips) by downsampling from the previous level, levels below
+	// first_level should be uploaded and image should be in transfer dst layout,
+	// leaves whole image in shader read layout (replaces Barrier_TransferToShaderRead)
+	virtual void GenerateMips(class IRHIImage *image, uint32_t first_level) = 0;
 
     virtual void SetEvent(IRHIEvent* event, RHIPipelineStageFlags::Value stage) = 0;
     virtual void ResetEvent(IRHIEvent* event, RHIPipelineStageFlags::Value stage) = 0;
@@ -830,6 +886,16 @@ public:
     virtual void Clear(IRHIImage *image_in, const vec4 &color, uint32_t img_aspect_bits,
 					   IRHIImage *ds_image_in, float depth, uint32_t stencil,
 					   uint32_t ds_img_aspect_bits) = 0;
+	// clears rects of one attachment of current subpass, only valid inside of the render pass
+	// color_attachment is ignored if img_aspect_bits has no RHIImageAspectFlags::kColor
+	// should be called outside of render pass
+	virtual void ResetQueryPool(IRHIQueryPool *pool, uint32_t first, uint32_t count) = 0;
+	virtual void WriteTimestamp(IRHIQueryPool *pool, RHIPipelineStageFlags::Value stage,
+								uint32_t query) = 0;
+
+	virtual void ClearAttachments(uint32_t img_aspect_bits, uint32_t color_attachment,
+								  const RHIClearValue &value, const RHIScissor *rects,
+								  uint32_t rect_count) = 0;
 	virtual ~IRHICmdBuf() = 0;
 };
 
@@ -889,6 +955,12 @@ public:
     virtual const IRHIPipelineLayout* Layout() const = 0;
 };
 
+class IRHIComputePipeline{
+public:
+	virtual ~IRHIComputePipeline() = 0; 
+    virtual const IRHIPipelineLayout* Layout() const = 0;
+};
+
 class IRHIBuffer {
 public:
   virtual void Destroy(IRHIDevice *device) = 0;
@@ -919,6 +991,15 @@ class IRHIEvent {
         virtual ~IRHIEvent() = 0; 
 };
 
+class IRHIQueryPool {
+    public:
+        // does not wait, returns false if any of the queries is not available yet
+        virtual bool GetTimestamps(IRHIDevice *device, uint32_t first, uint32_t count,
+                                   uint64_t *results) = 0;
+        virtual void Destroy(IRHIDevice *device) = 0;
+        virtual ~IRHIQueryPool() = 0; 
+};
+
 
 class IRHIDevice {
 public:
@@ -937,6 +1018,7 @@ public:
 
     virtual IRHIFence*          CreateFence(bool create_signalled) = 0;
     virtual IRHIEvent*          CreateEvent() = 0;
+    virtual IRHIQueryPool*      CreateTimestampQueryPool(uint32_t count) = 0;
 
     virtual IRHIGraphicsPipeline *CreateGraphicsPipeline(
             const RHIShaderStage *shader_stage, uint32_t shader_stage_count,
@@ -947,6 +1029,8 @@ public:
             const RHIColorBlendState *color_blend_state, const IRHIPipelineLayout *i_pipleline_layout,
             const RHIDynamicState::Value* dynamic_state, const uint32_t dynamic_state_count,
             const IRHIRenderPass *i_render_pass) = 0;
+    virtual IRHIComputePipeline *CreateComputePipeline(const RHIShaderStage *shader_stage,
+                                                       const IRHIPipelineLayout *i_pipleline_layout) = 0;
 
     virtual IRHIPipelineLayout* CreatePipelineLayout(const IRHIDescriptorSetLayout* const* desc_set_layouts, uint32_t count) = 0;
     virtual IRHIShader* CreateShader(RHIShaderStageFlagBits::Value stage, const uint32_t *pdata, uint32_t size) = 0;
@@ -961,6 +1045,7 @@ public:
     virtual uint32_t                GetCurrentSwapChainImageIndex() = 0;
 
     virtual uint32_t GetNumBufferedFrames() = 0;
+    virtual uint32_t GetCurrentFrame() = 0;
 
 	virtual bool Submit(IRHICmdBuf* cb, RHIQueueType::Value queue_type) = 0;
 	virtual bool BeginFrame() = 0;
@@ -973,6 +1058,8 @@ public:
     virtual void WaitIdle() = 0;
 
 	virtual const RHIPhysDeviceProperties& GetProperties() const = 0;
+	// true if GenerateMips can be used for images of this format
+	virtual bool CanGenerateMips(RHIFormat fmt) const = 0;
 };
 #if 0
 struct RenderContext {
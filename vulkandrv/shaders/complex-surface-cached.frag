@@ -0,0 +1,31 @@
+#version 450
+
+// Complex surface which diffuse and lightmap are already combined into surface cache atlas,
+// see surface-cache-build.frag. VS maps lightmap coordinates into the atlas.
+
+layout(location = 1) in vec2 v_LightmapTexCoord;
+
+////////////////////////////////////////////////////////////////////////////////
+
+layout(set=0, binding=1) uniform sampler2D SurfaceCacheTex;
+
+////////////////////////////////////////////////////////////////////////////////
+layout(location = 0) out vec4 o_Color;
+
+vec4 linear2gamma_rgb(vec4 c) {
+#if defined(USE_GAMMA)
+    vec4 r;
+    r.rgb = pow(c.rgb,vec3(1.0/2.8));
+    r.w = c.w;
+    return r;
+#else 
+    return c;
+#endif
+}
+
+void main() {
+    // cache stores half of the value to fit into 8 bits
+    const float OneXBlending = 0;
+    const vec4 c0 = vec4(0,0,0, 2 - OneXBlending);
+    o_Color = linear2gamma_rgb(c0.a * texture(SurfaceCacheTex, v_LightmapTexCoord));
+}
@@ -1,11 +1,13 @@
 #version 450
 
-//#define ALPHA_TEST
+// complex-surface-atest and complex-surface-nodetail variants are built from this file with
+// ALPHA_TEST and NO_DETAIL defined (see make-spir-v.bat and the project file)
 
 layout(location = 0) in vec2 v_TexCoord;
 layout(location = 1) in vec2 v_LightmapTexCoord;
 layout(location = 2) in vec4 v_DetailTexCoord; // xy = uv, z=viewpos.z w = is_fog
 layout(location = 3) in vec2 v_MacroTexCoord;
+layout(location = 4) flat in int v_PaletteRow; // -1 if diffuse is RGBA
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -13,12 +15,16 @@ layout(set=0, binding=0) uniform sampler2D DiffuseTex;
 layout(set=0, binding=1) uniform sampler2D LightmapTex;
 layout(set=0, binding=2) uniform sampler2D DetailTex;
 layout(set=0, binding=3) uniform sampler2D MacroTex;
+// paletted diffuse: 8 bit indices and a row per palette
+layout(set=0, binding=6) uniform usampler2D DiffuseIndexTex;
+layout(set=0, binding=7) uniform sampler2D PaletteTex;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Should be in sync with VS
 layout(set=0, binding=4) uniform PerFrameData_t {
     mat4 proj; // not really per frame though :-)
     vec4 DetailTexColor;
+    vec4 DetailParams; // x: 1 / detail fade distance (gUEDetailFadeDistance)
 } PerFrameData;
 
 layout(set=0, binding=5) uniform PerDrawCallData_t {
@@ -28,7 +34,6 @@ layout(set=0, binding=5) uniform PerDrawCallData_t {
 ////////////////////////////////////////////////////////////////////////////////
 layout(location = 0) out vec4 o_Color;
 
-#define Z_SCALE 0.002631578947
 //#define 0.999f, 0.0f, 1.0f\n"
 
 vec4 BGRA7_to_RGBA8(vec4 c) {
@@ -65,8 +70,42 @@ vec4 linear2gamma_rgb(vec4 c) {
 #endif
 }
 
+// UE textures and their mips are power of two sized, so masking wraps negative texels too, unlike %
+vec4 paletteFetch(ivec2 texel, ivec2 size, int level, int row) {
+    ivec2 wrapped = texel & (size - 1);
+    uint index = texelFetch(DiffuseIndexTex, wrapped, level).r;
+    return texelFetch(PaletteTex, ivec2(index, row), 0);
+}
+
+// indices can not be filtered, so colours are filtered after lookup
+vec4 paletteBilinear(vec2 uv, int level, int row) {
+    ivec2 size = textureSize(DiffuseIndexTex, level);
+    vec2 st = uv * vec2(size) - 0.5;
+    ivec2 t0 = ivec2(floor(st));
+    vec2 f = st - vec2(t0);
+    vec4 c00 = paletteFetch(t0, size, level, row);
+    vec4 c10 = paletteFetch(t0 + ivec2(1, 0), size, level, row);
+    vec4 c01 = paletteFetch(t0 + ivec2(0, 1), size, level, row);
+    vec4 c11 = paletteFetch(t0 + ivec2(1, 1), size, level, row);
+    return mix(mix(c00, c10, f.x), mix(c01, c11, f.x), f.y);
+}
+
+// trilinear, same as g_test_sampler does for RGBA textures
+vec4 samplePaletted(vec2 uv, int row) {
+    vec2 texels = uv * vec2(textureSize(DiffuseIndexTex, 0));
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    int max_level = textureQueryLevels(DiffuseIndexTex) - 1;
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(max_level));
+    int level0 = int(lod);
+    int level1 = min(level0 + 1, max_level);
+    return mix(paletteBilinear(uv, level0, row), paletteBilinear(uv, level1, row), lod - float(level0));
+}
+
 void main() {
-    vec4 albedo = gamma2linear_rgb(texture(DiffuseTex, v_TexCoord));
+    // row is flat, so this branch is uniform within a draw
+    vec4 albedo = gamma2linear_rgb(v_PaletteRow >= 0 ? samplePaletted(v_TexCoord, v_PaletteRow)
+                                                     : texture(DiffuseTex, v_TexCoord));
 
 #if defined(ALPHA_TEST)
     if(albedo.a < 0.5) {
@@ -85,15 +124,18 @@ void main() {
         albedo.rgb = c0.a * albedo.rgb * macro.rgb;
     }
 
-    // detail
+    // detail, variant without it is used when no detail texture is bound (or all of a facet is
+    // beyond detail fade distance)
+#if !defined(NO_DETAIL)
     if(v_DetailTexCoord.x>=0 && v_DetailTexCoord.y>=0 && is_fog<0.5) {
         vec4 detail = gamma2linear_rgb(texture(DetailTex, v_DetailTexCoord.xy));
         // reconstructed after D3D9 assembly
         float vPosZ = v_DetailTexCoord.z;
-        float k = clamp(vPosZ *Z_SCALE, 0,1); // vpos.z
+        float k = clamp(vPosZ * PerFrameData.DetailParams.x, 0,1); // vpos.z
         vec3 detail_color = (PerFrameData.DetailTexColor.rgb); // linear or gamma?
         albedo.rgb = c0.a*albedo.rgb*(detail_color*k + (1-k)*detail.rgb);
     }
+#endif
 
     // in D3D9 first lightmap is blended and then detail, but I think applying lightmapshould be done after detail
     if(v_LightmapTexCoord.x>=0 && v_LightmapTexCoord.y>=0) {
@@ -1,7 +1,6 @@
 #version 450
 
 layout(location = 0) in vec3 Pos;
-layout(location = 1) in vec2 TexCoord;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Should be in sync with FS
@@ -25,6 +24,8 @@ layout(set=1, binding=0) uniform PerDrawCallVSData_t {
 	vec4 Detail_PanXY_UVMult;
 	vec4 HasDetail_UVScale;//x-has detail, yz UVScale, w -is_fog
     mat4 proj;
+    mat4 WorldToView; // identity if Pos is already in view space
+    vec4 Palette; // x - row of diffuse palette in PaletteTex, -1 if diffuse is RGBA
 } PerDrawVSData;
 
 
@@ -34,14 +35,18 @@ out gl_PerVertex
 {
     vec4 gl_Position;
 };
+// depth pre-pass (depth-only.vert) has to produce bit exact same depth for EQUAL test
+invariant gl_Position;
 
 layout(location = 0) out vec2 v_TexCoord;
 layout(location = 1) out vec2 v_LightmapTexCoord;
 layout(location = 2) out vec4 v_DetailTexCoord;
 layout(location = 3) out vec2 v_MacroTexCoord;
+layout(location = 4) flat out int v_PaletteRow;
 
 void main() {
-    gl_Position = vec4(Pos.xyz,1) * /*PerFrameData.world * PerFrameData.view * */PerFrameData.proj;
+    vec3 ViewPos = (vec4(Pos.xyz,1) * PerDrawVSData.WorldToView).xyz;
+    gl_Position = vec4(ViewPos,1) * /*PerFrameData.world * PerFrameData.view * */PerDrawVSData.proj;
 
     vec3 AxisX = PerDrawVSData.AxisX_UDot.xyz;
     float UDot = PerDrawVSData.AxisX_UDot.w;
@@ -51,12 +56,13 @@ void main() {
     vec2 Diffuse_Pan = PerDrawVSData.Diffuse_PanXY_UVMult.xy;
     vec2 Diffuse_UVMult = PerDrawVSData.Diffuse_PanXY_UVMult.zw;
 
-	float U = dot(AxisX, Pos.xyz);
-	float V = dot(AxisY, Pos.xyz);
+	float U = dot(AxisX, ViewPos);
+	float V = dot(AxisY, ViewPos);
 	vec2 Coord = vec2(U-UDot, V - VDot);
 
 	//Diffuse texture coordinates
 	v_TexCoord = (Coord - Diffuse_Pan)*Diffuse_UVMult;
+    v_PaletteRow = int(PerDrawVSData.Palette.x);
 
     if(PerDrawVSData.HasMacro_UVScale.x>0) {
         vec2 Macro_Pan = PerDrawVSData.Macro_PanXY_UVMult.xy;
@@ -89,7 +95,7 @@ void main() {
 	    v_DetailTexCoord.xy = (Coord - (Detail_Pan - 0.5*UVScale))*Detail_UVMult;
         // detail scale from D3D9 renderer
         v_DetailTexCoord.xy *= (1-is_fog) * 3.223 + 1;
-        v_DetailTexCoord.zw = vec2(Pos.z, is_fog);
+        v_DetailTexCoord.zw = vec2(ViewPos.z, is_fog);
     }
     else {
 	    v_DetailTexCoord = vec4(-1, -1, 0,0);
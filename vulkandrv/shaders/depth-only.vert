@@ -0,0 +1,34 @@
+#version 450
+
+// Depth pre-pass for opaque complex surfaces, position computation must match complex-surface.vert
+
+layout(location = 0) in vec3 Pos;
+
+////////////////////////////////////////////////////////////////////////////////
+// Same dynamic UB as in complex-surface.vert, only the part we need
+layout(set=0, binding=0) uniform PerDrawCallVSData_t {
+    vec4 AxisX_UDot;
+    vec4 AxisY_VDot;
+    vec4 Diffuse_PanXY_UVMult;
+	vec4 Macro_PanXY_UVMult;
+	vec4 HasMacro_UVScale;
+    vec4 Lightmap_PanXY_UVMult;
+    vec4 HasLightmap_UVScale;
+	vec4 Detail_PanXY_UVMult;
+	vec4 HasDetail_UVScale;
+    mat4 proj;
+    mat4 WorldToView;
+} PerDrawVSData;
+
+////////////////////////////////////////////////////////////////////////////////
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+invariant gl_Position;
+
+void main() {
+    vec3 ViewPos = (vec4(Pos.xyz,1) * PerDrawVSData.WorldToView).xyz;
+    gl_Position = vec4(ViewPos,1) * PerDrawVSData.proj;
+}
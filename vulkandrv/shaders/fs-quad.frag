@@ -1,8 +0,0 @@
-#version 400
-
-layout(location = 0) out vec4 out_Color;
-
-void main() {
-  out_Color = vec4( 0.0, 0.4, 1.0, 1.0 );
-}
-
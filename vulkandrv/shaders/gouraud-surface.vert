@@ -26,6 +26,8 @@ out gl_PerVertex
 {
     vec4 gl_Position;
 };
+// masked surfaces are drawn twice (masked-depth.frag and then colour with EQUAL depth test)
+invariant gl_Position;
 
 layout(location = 0) out vec2 v_TexCoord;
 layout(location = 1) out vec4 v_Color;
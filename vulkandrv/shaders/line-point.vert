@@ -0,0 +1,27 @@
+#version 450
+
+layout(location = 0) in vec3 Pos;
+layout(location = 1) in vec4 Color;
+
+////////////////////////////////////////////////////////////////////////////////
+// uses gouraud surface pipeline layout, only VS data is used
+
+// this is dynamic UB, should be setup once and offset provided during bind ds
+layout(set=1, binding=0) uniform PerDrawCallVSData_t {
+    mat4 proj;
+} PerDrawVSData;
+
+////////////////////////////////////////////////////////////////////////////////
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec4 v_Color;
+
+void main() {
+    gl_Position = vec4(Pos.xyz,1) * PerDrawVSData.proj;
+	v_Color = Color;
+}
+
@@ -0,0 +1,18 @@
+#version 450
+
+// Depth phase of masked surfaces (both complex and gouraud), only alpha test and no colour output.
+// Colour is drawn afterwards with EQUAL depth test and without discard.
+
+layout(location = 0) in vec2 v_TexCoord;
+
+////////////////////////////////////////////////////////////////////////////////
+
+layout(set=0, binding=0) uniform sampler2D DiffuseTex;
+
+////////////////////////////////////////////////////////////////////////////////
+
+void main() {
+    if(texture(DiffuseTex, v_TexCoord).a < 0.5) {
+        discard;
+    }
+}
@@ -0,0 +1,36 @@
+#version 450
+
+// Diffuse modulated by lightmap, same as in complex-surface.frag but without the final 2x, so that
+// it fits into 8 bits (lightmaps are 7 bit). complex-surface-cached.frag applies it.
+
+layout(location = 0) in vec2 v_TexCoord;
+layout(location = 1) in vec2 v_LightmapTexCoord;
+
+////////////////////////////////////////////////////////////////////////////////
+
+layout(set=0, binding=0) uniform sampler2D DiffuseTex;
+layout(set=0, binding=1) uniform sampler2D LightmapTex;
+
+////////////////////////////////////////////////////////////////////////////////
+layout(location = 0) out vec4 o_Color;
+
+vec4 BGRA7_to_RGBA8(vec4 c) {
+    return 2*c.bgra;
+}
+
+vec4 gamma2linear_rgb(vec4 c) {
+#if defined(USE_GAMMA)
+    vec4 r;
+    r.rgb = pow(c.rgb,vec3(2.2));
+    r.w = c.w;
+    return r;
+#else
+    return c;
+#endif
+}
+
+void main() {
+    vec4 albedo = gamma2linear_rgb(texture(DiffuseTex, v_TexCoord));
+    vec4 lightmap = gamma2linear_rgb(texture(LightmapTex, v_LightmapTexCoord));
+    o_Color = albedo * BGRA7_to_RGBA8(lightmap);
+}
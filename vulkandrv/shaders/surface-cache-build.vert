@@ -0,0 +1,21 @@
+#version 450
+
+// Draws one surface cache tile: quad covering the tile and its border in the atlas page
+
+layout(location = 0) in vec2 Pos; // NDC in the atlas page
+layout(location = 1) in vec2 LightmapTexCoord;
+layout(location = 2) in vec2 DiffuseTexCoord;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec2 v_TexCoord;
+layout(location = 1) out vec2 v_LightmapTexCoord;
+
+void main() {
+    gl_Position = vec4(Pos, 0, 1);
+    v_TexCoord = DiffuseTexCoord;
+    v_LightmapTexCoord = LightmapTexCoord;
+}
@@ -1,3 +1,4 @@
+#include <windows.h>
 #include "texture_cache.h"
 #include "rhi.h"
 #include "utils/logging.h"
@@ -7,15 +8,21 @@
 #pragma pack(pop)
 
 #include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <intrin.h>
+#include <immintrin.h>
 
 struct TextureFormat {
 	bool b_is_supported; /**< Is format supported by us */
-	INT blocksize;		 /**< Block size (in one dimension) in bytes for compressed textures */
-	char pixelsPerBlock; /**< Pixels each block of a compressed texture encodes */
+	INT blocksize;		 /**< Block size (in one dimension) in pixels for compressed textures */
+	char bytesPerBlock;	 /**< Bytes each block of a compressed texture takes */
 	bool directAssign;	 /**< No conversion and temporary storage needed */
 	RHIFormat RHIFormat; /**< format to use when creating texture */
-	void (*conversionFunc)(const FTextureInfo *, DWORD flags, DWORD *dst, uint32_t dst_size,
-						   int level); /**< Conversion function to use if no direct assignment possible */
+	PaletteExpandFunc conversionFunc; /**< Conversion function to use if no direct assignment possible */
 };
 
 struct TextureMetaData {
@@ -32,35 +39,56 @@ struct TextureMetaData {
 							*/
 };
 
-void Paletted2RGBA8(const FTextureInfo *, DWORD flags, DWORD* dst, uint32_t dst_size, int level);
+static void Paletted2RGBA8(const DWORD *palette, const BYTE *src, DWORD *dst, uint32_t count);
 	bool bUseSRGB = false;
 // Unreal to vulkan
 const static TextureFormat g_format_reg[] = {
 	{true, 0, 0, false, bUseSRGB ? RHIFormat::kR8G8B8A8_SRGB : RHIFormat::kR8G8B8A8_UNORM, &Paletted2RGBA8}, /**< TEXF_P8 = 0x00 */
 	{true, 0, 0, true, bUseSRGB  ? RHIFormat::kR8G8B8A8_SRGB : RHIFormat::kR8G8B8A8_UNORM, nullptr},		  /**< TEXF_RGBA7	= 0x01 */
 	{false, 0, 0, true, bUseSRGB ? RHIFormat::kR8G8B8A8_SRGB : RHIFormat::kR8G8B8A8_UNORM, nullptr},		  /**< TEXF_RGB16	= 0x02 */
-#if 0
-	{true,4,8,true,DXGI_FORMAT_BC1_UNORM,nullptr},									/**< TEXF_DXT1 = 0x03 */
-	{false,0,0,true,DXGI_FORMAT_UNKNOWN,nullptr},									/**< TEXF_RGB8 = 0x04 */
-	{true,0,0,true,DXGI_FORMAT_R8G8B8A8_UNORM,nullptr},								/**< TEXF_RGBA8	= 0x05 */
-#endif
+	{true, 4, 8, true, bUseSRGB  ? RHIFormat::kBC1_RGBA_SRGB : RHIFormat::kBC1_RGBA_UNORM, nullptr},	  /**< TEXF_DXT1 = 0x03 */
+	{false, 0, 0, true, RHIFormat::kUNDEFINED, nullptr},															  /**< TEXF_RGB8 = 0x04 */
+	// 32bit engine colours are BGRA in memory (see BGRA7_to_RGBA8 in shaders)
+	{true, 0, 0, true, bUseSRGB  ? RHIFormat::kB8G8R8A8_SRGB : RHIFormat::kB8G8R8A8_UNORM, nullptr},	  /**< TEXF_RGBA8	= 0x05 */
+	// only sent by engines with extended S3TC support (TEXF_BC2/TEXF_BC3 in 469 headers)
+	{true, 4, 16, true, bUseSRGB ? RHIFormat::kBC2_SRGB : RHIFormat::kBC2_UNORM, nullptr},			  /**< TEXF_DXT3 = 0x06 */
+	{true, 4, 16, true, bUseSRGB ? RHIFormat::kBC3_SRGB : RHIFormat::kBC3_UNORM, nullptr},			  /**< TEXF_DXT5 = 0x07 */
 };
 
-struct MipInfo {
-	uint32_t SysMemPitch;
-	DWORD* pSysMem;
-	uint32_t size;
-	bool b_owns_memory;
-};
+static bool isBlockCompressed(const TextureFormat &format) {
+	return format.blocksize > 0;
+}
+
+// at least as many as frames in flight
+enum { kMaxRingImages = 4 };
 
 struct CachedTexture {
 	TextureMetaData metadata;
+	// current image of the ring for realtime textures
 	IRHIImage* image;
 	IRHIImageView* view;
+	// mips uploaded from the engine, rest of the image chain (if any) is generated on GPU
+	int num_mips;
+	// being converted by a worker, not uploaded yet
+	bool pending;
+	// Realtime textures get one image per frame in flight once they are first updated. Update
+	// writes the next one, which was last sampled by a frame that has already finished, so upload
+	// does not wait for frames still on GPU.
+	IRHIImage* ring_image[kMaxRingImages];
+	IRHIImageView* ring_view[kMaxRingImages];
+	int ring_size;
+	int ring_cur;
+	uint32_t last_update_frame;
+	// row in PaletteTable if texture is stored as indices, -1 otherwise
+	int palette_row;
+	// of indices, update only uploads them when they change
+	uint64_t index_hash;
 };
 
 struct CacheImpl {
 	std::unordered_map<unsigned __int64, CachedTexture> thash;
+	// TEXF_P8 textures are stored as indices, see PaletteTable
+	bool b_paletted;
 };
 
 int getTextureSize(RHIFormat fmt, int w, int h) {
@@ -70,85 +98,728 @@ int getTextureSize(RHIFormat fmt, int w, int h) {
 	case RHIFormat::kR8G8B8A8_UNORM:
 	case RHIFormat::kR8G8B8A8_SRGB:
 		return w * h * 4;
+	case RHIFormat::kR8_UINT:
+		return w * h;
+	// each mip is at least one block in each direction
+	case RHIFormat::kBC1_RGBA_UNORM:
+	case RHIFormat::kBC1_RGBA_SRGB:
+		return ((w + 3) / 4) * ((h + 3) / 4) * 8;
+	case RHIFormat::kBC2_UNORM:
+	case RHIFormat::kBC2_SRGB:
+	case RHIFormat::kBC3_UNORM:
+	case RHIFormat::kBC3_SRGB:
+		return ((w + 3) / 4) * ((h + 3) / 4) * 16;
 	default:
 		assert(!"Not implemented");
 		return -1;
 	}
 }
 
-MipInfo convertMip(const FTextureInfo *TexInfo, const TextureFormat &format, DWORD PolyFlags,
-				   int mipLevel) {
-	MipInfo mi;
-	// Set stride
-	if (format.blocksize > 0) {
-		// Max() as each mip is at least block sized in each direction
-		mi.SysMemPitch = max(TexInfo->Mips[mipLevel]->USize, format.blocksize) *
-						 format.pixelsPerBlock / format.blocksize;
-	} else {
-		// Pitch is set so garbage data outside of UClamp is skipped
-		mi.SysMemPitch = TexInfo->Mips[mipLevel]->USize * sizeof(DWORD);
+// Size of w x h mip in format.RHIFormat, each mip of compressed one is at least one block in each
+// direction
+static int getMipSize(const TextureFormat &format, int w, int h) {
+	if (isBlockCompressed(format)) {
+		const int bs = format.blocksize;
+		return ((w + bs - 1) / bs) * ((h + bs - 1) / bs) * format.bytesPerBlock;
 	}
+	return getTextureSize(format.RHIFormat, w, h);
+}
 
-	// Assign or convert
-	if (format.directAssign) {
-		// Direct assignment from Unreal to our texture is possible
-		mi.pSysMem = (DWORD*)TexInfo->Mips[mipLevel]->DataPtr;
-		mi.b_owns_memory = false;
-		mi.size = getTextureSize(format.RHIFormat, TexInfo->Mips[mipLevel]->USize,
-								 TexInfo->Mips[mipLevel]->VSize);
-		if (mi.size == 512 && TexInfo->USize==128) {
-			int asdfa = 0;
-		}
-	} else {
-		// Texture needs to be converted via temporary data; allocate it
-		// max(...) as otherwise USize*0 can occur
-		// ???
-		uint32_t dw_size = TexInfo->Mips[mipLevel]->USize * max((TexInfo->VClamp >> mipLevel), 1);
-		//uint32_t dw_size = TexInfo->Mips[mipLevel]->USize * TexInfo->Mips[mipLevel]->VSize;
-		mi.pSysMem = new (std::nothrow) DWORD[dw_size];
-		mi.size = dw_size * sizeof(DWORD);
-		if (mi.pSysMem == nullptr) {
-			log_error("Convert: Error allocating texture initial data memory.");
-			return mi;
-		}				
-		mi.b_owns_memory = true;
+// Copy for write only (staging) memory: non temporal stores do not pull destination into cache.
+// dst has to be 16 byte aligned
+static void copyStreaming(BYTE *dst, const BYTE *src, uint32_t size) {
+	assert(((uintptr_t)dst & 15) == 0);
+	uint32_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+		const __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+		_mm_stream_si128((__m128i *)(dst + i), a);
+		_mm_stream_si128((__m128i *)(dst + i + 16), b);
+		_mm_stream_si128((__m128i *)(dst + i + 32), c);
+		_mm_stream_si128((__m128i *)(dst + i + 48), d);
+	}
+	memcpy(dst + i, src + i, size - i);
+}
 
-		if (mi.size != 4*TexInfo->Mips[mipLevel]->USize * TexInfo->Mips[mipLevel]->VSize) {
-			int asdfasdf = 0;
-		}
-		if (mi.size == 524288) {
-			int asdf = 124;
+// Number of mips which can be uploaded: engine mips (if loaded) while they have the size Vulkan
+// expects for the level
+static int getNumUploadMips(const FTextureInfo *TexInfo) {
+	const INT w = TexInfo->Mips[0]->USize;
+	const INT h = TexInfo->Mips[0]->VSize;
+	int num_mips = 1;
+	while (num_mips < TexInfo->NumMips && num_mips < TextureUploadTask::kMaxMips) {
+		const FMipmapBase *mip = TexInfo->Mips[num_mips];
+		if (!mip || !mip->DataPtr || mip->USize != max(w >> num_mips, 1) ||
+			mip->VSize != max(h >> num_mips, 1)) {
+			break;
 		}
+		num_mips++;
+	}
+	return num_mips;
+}
 
-		//Convert
-		format.conversionFunc(TexInfo, PolyFlags, mi.pSysMem, mi.size, mipLevel);
+// Full mip chain down to 1x1
+static int getNumFullChainMips(int w, int h) {
+	int num_mips = 1;
+	while ((w | h) >> num_mips) {
+		num_mips++;
 	}
+	return num_mips;
+}
 
-	return mi;
+// Packs num_mips mips one after another into staging buffer layout, fills copy regions.
+// Returns total size in bytes.
+static int layoutMipChain(const FTextureInfo *TexInfo, const TextureFormat &format, int num_mips,
+						  RHIBufferImageCopy *regions) {
+	uint32_t size = 0;
+	for (int level = 0; level < num_mips; ++level) {
+		// buffer offset has to be a multiple of texel (block) size
+		const uint32_t offset = (size + 15) & ~15u;
+		regions[level].bufferOffset = offset;
+		regions[level].mipLevel = level;
+		regions[level].width = TexInfo->Mips[level]->USize;
+		regions[level].height = TexInfo->Mips[level]->VSize;
+		regions[level].x = 0;
+		regions[level].y = 0;
+		// converted formats produce texels of format.RHIFormat as well
+		size = offset + getMipSize(format, TexInfo->Mips[level]->USize, TexInfo->Mips[level]->VSize);
+	}
+	return (int)size;
 }
 
-// Convert from palleted 8bpp to r8g8b8a8.
-void Paletted2RGBA8(const FTextureInfo *TexInfo, DWORD PolyFlags, DWORD* dst, uint32_t dst_size, int mipLevel) {
+// Everything conversion needs, copied out of FTextureInfo so that it can run on a worker thread.
+// Mip data itself is not copied: it belongs to the engine texture which stays loaded while cached
+// (realtime textures which change it every frame are never converted asynchronously)
+struct MipChainSource {
+	const TextureFormat *format;
+	const BYTE *mips[TextureUploadTask::kMaxMips];
+	int num_mips;
+	// local copy, so engine palette is never modified (masking) and may change while we convert
+	DWORD palette[256];
+};
 
+// Palette as the texture is drawn with
+static void getPalette(const FTextureInfo *TexInfo, DWORD PolyFlags, DWORD *palette) {
+	memcpy(palette, TexInfo->Palette, 256 * sizeof(DWORD));
 	// If texture is masked with palette index 0 = transparent; make that index black w. alpha 0
 	// (black looks best for the border that gets left after masking)
 	if (PolyFlags & PF_Masked) {
-		*(DWORD *)(&(TexInfo->Palette->R)) = (DWORD)0;
+		palette[0] = 0;
+	}
+}
+
+static void fillMipChainSource(const FTextureInfo *TexInfo, const TextureFormat &format,
+							   DWORD PolyFlags, int num_mips, MipChainSource &src) {
+	src.format = &format;
+	src.num_mips = num_mips;
+	for (int level = 0; level < num_mips; ++level) {
+		src.mips[level] = (const BYTE *)TexInfo->Mips[level]->DataPtr;
+	}
+	if (format.conversionFunc) {
+		getPalette(TexInfo, PolyFlags, src.palette);
+	}
+}
+
+// Converts (or copies) mips right into mapped staging memory at offsets from layoutMipChain
+static void writeMipChain(const MipChainSource &src, const RHIBufferImageCopy *regions, BYTE *dst) {
+	const TextureFormat &format = *src.format;
+	for (int level = 0; level < src.num_mips; ++level) {
+		const uint32_t w = regions[level].width;
+		const uint32_t h = regions[level].height;
+		BYTE *mip_dst = dst + regions[level].bufferOffset;
+		if (format.directAssign) {
+			copyStreaming(mip_dst, src.mips[level], getMipSize(format, w, h));
+		} else {
+			format.conversionFunc(src.palette, src.mips[level], (DWORD *)mip_dst, w * h);
+		}
+	}
+	// make streaming stores visible before staging buffer is used by GPU
+	_mm_sfence();
+}
+
+static void expandPaletteScalar(const DWORD *palette, const BYTE *src, DWORD *dst, uint32_t count) {
+	const BYTE *src_end = src + count;
+	while (src < src_end) {
+		*dst++ = palette[*src++];
+	}
+}
+
+// 16 pixels per iteration: zero extend indices to 32 bit and gather palette entries
+static void expandPaletteAVX2(const DWORD *palette, const BYTE *src, DWORD *dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m128i idx = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m256i idx_lo = _mm256_cvtepu8_epi32(idx);
+		const __m256i idx_hi = _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8));
+		const __m256i col_lo = _mm256_i32gather_epi32((const int *)palette, idx_lo, 4);
+		const __m256i col_hi = _mm256_i32gather_epi32((const int *)palette, idx_hi, 4);
+		_mm256_storeu_si256((__m256i *)(dst + i), col_lo);
+		_mm256_storeu_si256((__m256i *)(dst + i + 8), col_hi);
+	}
+	expandPaletteScalar(palette, src + i, dst + i, count - i);
+}
+
+static bool cpuHasAVX2() {
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	// OS has to save ymm registers as well
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+
+PaletteExpandFunc getPaletteExpandFunc(bool allow_simd) {
+	static const bool has_avx2 = cpuHasAVX2();
+	return (allow_simd && has_avx2) ? &expandPaletteAVX2 : &expandPaletteScalar;
+}
+
+// Convert from palleted 8bpp to r8g8b8a8.
+static void Paletted2RGBA8(const DWORD *palette, const BYTE *src, DWORD *dst, uint32_t count) {
+	static const PaletteExpandFunc expand = getPaletteExpandFunc(true);
+	expand(palette, src, dst, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GPU expansion of paletted textures
+////////////////////////////////////////////////////////////////////////////////
+
+// expanded size limit, 0 if GPU expansion is off
+static uint32_t g_gpu_expansion_max_size = 0;
+
+// Mips are 16 byte aligned in expanded layout, so indices of each mip start at a 4 byte boundary.
+// Bytes in between are never copied to the image and are left as they are.
+static int getExpansionSourceSize(int expanded_size) {
+	return kExpandIndexOffset + ((expanded_size / 4 + 3) & ~3);
+}
+
+static void writeExpansionSource(const MipChainSource &src, const RHIBufferImageCopy *regions,
+								 BYTE *dst) {
+	assert(src.format->conversionFunc == &Paletted2RGBA8);
+	copyStreaming(dst, (const BYTE *)src.palette, sizeof(src.palette));
+	for (int level = 0; level < src.num_mips; ++level) {
+		memcpy(dst + kExpandIndexOffset + regions[level].bufferOffset / 4, src.mips[level],
+			   regions[level].width * regions[level].height);
+	}
+	_mm_sfence();
+}
+
+int texture_validate_expansion(const TextureUploadTask *task) {
+	assert(task->expanded_size > 0 && task->readback_buf);
+	const BYTE *src = (const BYTE *)task->img_staging_buf->MappedPtr();
+	const DWORD *palette = (const DWORD *)src;
+	const DWORD *expanded = (const DWORD *)task->readback_buf->MappedPtr();
+	std::vector<DWORD> converted;
+	int num_different = 0;
+	for (int level = 0; level < task->num_mips; ++level) {
+		const RHIBufferImageCopy &r = task->mips[level];
+		const uint32_t count = r.width * r.height;
+		converted.resize(count);
+		Paletted2RGBA8(palette, src + kExpandIndexOffset + r.bufferOffset / 4, converted.data(),
+					   count);
+		const DWORD *mip = expanded + r.bufferOffset / 4;
+		for (uint32_t i = 0; i < count; ++i) {
+			num_different += mip[i] != converted[i];
+		}
+	}
+	return num_different;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// On-disk cache of converted textures
+////////////////////////////////////////////////////////////////////////////////
+
+// Converted mip chains in staging layout (see layoutMipChain), so a hit is one copy from the
+// mapped file into staging memory. Pack file is a header followed by entries, each is a header and
+// data; index is rebuilt by reading entry headers on open and a truncated tail entry is dropped.
+// Entries are looked up by CacheID and a signature which is cheap to compute (see
+// diskCacheSignature), a changed texture of the same size is overwritten in place, otherwise a new
+// entry is appended and the old one is reclaimed by compaction on the next open.
+static const uint32_t kDiskCacheMagic = 0x43544b56; // "VKTC"
+static const uint32_t kDiskCacheVersion = 2;
+static const uint32_t kDiskCacheEntryMagic = 0x4e544b56; // "VKTN"
+static const uint32_t kDiskCacheMaxSize = 256 * 1024 * 1024;
+// pack is compacted on open if superseded entries take more than this part of it
+static const uint32_t kDiskCacheMaxDeadFraction = 4;
+
+struct DiskCachePackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t reserved[2];
+};
+
+struct DiskCacheEntryHeader {
+	uint32_t magic;
+	uint32_t size;
+	CacheKey_t key;
+	uint64_t signature;
+	uint64_t reserved;
+};
+
+static_assert(sizeof(DiskCachePackHeader) == 16 && sizeof(DiskCacheEntryHeader) == 32,
+			  "Disk cache headers should keep data 16 byte aligned");
+
+// bytes entry with size bytes of data takes in the pack
+static uint32_t diskCacheEntrySpan(uint32_t size) {
+	return (uint32_t)sizeof(DiskCacheEntryHeader) + ((size + 15) & ~15u);
+}
+
+struct TextureDiskCache {
+	struct Entry {
+		uint64_t signature;
+		uint32_t offset; // of data
+		uint32_t size;
+	};
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	// UE is a 32 bit process, so only the entry being read is mapped, never the whole pack. Mapping
+	// object covers the file as it was when created, it is recreated for entries stored later.
+	HANDLE mapping = nullptr;
+	uint32_t mapping_size = 0;
+	const void *view = nullptr;
+	uint32_t granularity = 0;
+	// end of the last entry, new ones are written there
+	uint32_t file_size = 0;
+	bool b_full = false;
+	// workers store entries while render thread looks them up, mapping is only touched by the
+	// render thread (find)
+	std::mutex mutex;
+	std::unordered_map<CacheKey_t, Entry> index;
+	int num_hits = 0;
+	int num_misses = 0;
+	int num_stored = 0;
+
+	bool isOpen() const { return file != INVALID_HANDLE_VALUE; }
+
+	bool open(const char *path) {
+		assert(!isOpen());
+		file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+						   FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			log_error("TextureDiskCache: can't open %s (error %d), disabled\n", path,
+					  (int)GetLastError());
+			return false;
+		}
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		granularity = si.dwAllocationGranularity;
+
+		const DWORD size = GetFileSize(file, nullptr);
+		uint32_t end = 0;
+		uint32_t dead = 0;
+		DiskCachePackHeader hdr;
+		if (size != INVALID_FILE_SIZE && size <= kDiskCacheMaxSize && readAt(0, &hdr, sizeof(hdr)) &&
+			hdr.magic == kDiskCacheMagic && hdr.version == kDiskCacheVersion) {
+			end = sizeof(DiskCachePackHeader);
+			DiskCacheEntryHeader e;
+			while (end + sizeof(DiskCacheEntryHeader) <= size && readAt(end, &e, sizeof(e))) {
+				const uint32_t data = end + sizeof(DiskCacheEntryHeader);
+				if (e.magic != kDiskCacheEntryMagic || e.size > size - data) {
+					break;
+				}
+				auto it = index.find(e.key);
+				if (it != index.end()) {
+					dead += diskCacheEntrySpan(it->second.size);
+				}
+				Entry entry = {e.signature, data, e.size};
+				index[e.key] = entry;
+				end = data + ((e.size + 15) & ~15u);
+			}
+		}
+
+		if (end && dead > end / kDiskCacheMaxDeadFraction) {
+			end = compact();
+		}
+
+		// new, stale or damaged file: start over, otherwise drop whatever follows last good entry
+		if (!end) {
+			index.clear();
+			DiskCachePackHeader new_hdr = {kDiskCacheMagic, kDiskCacheVersion, {0, 0}};
+			if (!writeAt(0, &new_hdr, sizeof(new_hdr))) {
+				close();
+				return false;
+			}
+			end = sizeof(new_hdr);
+		}
+		SetFilePointer(file, end, nullptr, FILE_BEGIN);
+		SetEndOfFile(file);
+		file_size = end;
+
+		log_info("TextureDiskCache: %s, %d textures, %d KB\n", path, (int)index.size(),
+				 file_size / 1024);
+		return true;
+	}
+
+	void close() {
+		if (!isOpen()) {
+			return;
+		}
+		if (num_hits || num_misses) {
+			log_info("TextureDiskCache: %d hits, %d misses, %d stored\n", num_hits, num_misses,
+					 num_stored);
+		}
+		unmap();
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		index.clear();
+	}
+
+	// Converted data of the texture if it is cached with the same signature, valid until next call
+	const BYTE *find(CacheKey_t key, uint64_t signature, uint32_t size) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = index.find(key);
+		if (it == index.end() || it->second.signature != signature || it->second.size != size) {
+			num_misses++;
+			return nullptr;
+		}
+		const BYTE *data = mapEntry(it->second.offset, size);
+		if (!data) {
+			num_misses++;
+			return nullptr;
+		}
+		num_hits++;
+		return data;
+	}
+
+	void store(CacheKey_t key, uint64_t signature, const BYTE *data, uint32_t size) {
+		std::lock_guard<std::mutex> lock(mutex);
+		// same size: texture changed (or its signature did), its entry is rewritten
+		auto it = index.find(key);
+		const bool b_overwrite = it != index.end() && it->second.size == size;
+		const uint32_t data_offset =
+			b_overwrite ? it->second.offset : file_size + (uint32_t)sizeof(DiskCacheEntryHeader);
+		const uint32_t end = data_offset + ((size + 15) & ~15u);
+		if (!b_overwrite && (b_full || end > kDiskCacheMaxSize)) {
+			if (!b_full) {
+				log_info("TextureDiskCache: pack is full, new textures are not stored\n");
+				b_full = true;
+			}
+			return;
+		}
+
+		// rewritten entry matches nothing until its data is complete
+		DiskCacheEntryHeader hdr = {kDiskCacheEntryMagic, size, key, b_overwrite ? 0 : signature, 0};
+		static const BYTE padding[16] = {0};
+		const uint32_t hdr_offset = data_offset - sizeof(hdr);
+		bool b_ok = writeAt(hdr_offset, &hdr, sizeof(hdr)) && writeAt(data_offset, data, size) &&
+					writeAt(data_offset + size, padding, end - data_offset - size);
+		if (b_ok && b_overwrite) {
+			hdr.signature = signature;
+			b_ok = writeAt(hdr_offset, &hdr, sizeof(hdr));
+		}
+		if (!b_ok) {
+			// entry is incomplete, it is overwritten by the next one or dropped on open
+			if (b_overwrite) {
+				index.erase(it);
+			}
+			b_full = true;
+			return;
+		}
+		Entry entry = {signature, data_offset, size};
+		index[key] = entry;
+		if (!b_overwrite) {
+			file_size = end;
+		}
+		num_stored++;
+	}
+
+  private:
+	bool readAt(uint32_t offset, void *data, uint32_t size) {
+		DWORD read = 0;
+		SetFilePointer(file, offset, nullptr, FILE_BEGIN);
+		return ReadFile(file, data, size, &read, nullptr) && read == size;
+	}
+
+	bool writeAt(uint32_t offset, const void *data, uint32_t size) {
+		if (!size) {
+			return true;
+		}
+		DWORD written = 0;
+		SetFilePointer(file, offset, nullptr, FILE_BEGIN);
+		if (!WriteFile(file, data, size, &written, nullptr) || written != size) {
+			log_error("TextureDiskCache: write failed (error %d)\n", (int)GetLastError());
+			return false;
+		}
+		return true;
+	}
+
+	// Moves live entries down over superseded ones, returns new end of the pack or 0 on failure.
+	// Pack header is invalid while entries are moved, so interrupted compaction starts pack over.
+	uint32_t compact() {
+		std::vector<std::pair<uint32_t, CacheKey_t> > live;
+		live.reserve(index.size());
+		for (auto it = index.begin(); it != index.end(); ++it) {
+			live.push_back(std::make_pair(it->second.offset, it->first));
+		}
+		std::sort(live.begin(), live.end());
+
+		const DiskCachePackHeader invalid_hdr = {0, 0, {0, 0}};
+		if (!writeAt(0, &invalid_hdr, sizeof(invalid_hdr))) {
+			return 0;
+		}
+		uint32_t end = sizeof(DiskCachePackHeader);
+		std::vector<BYTE> buf;
+		for (size_t i = 0; i < live.size(); ++i) {
+			Entry &entry = index[live[i].second];
+			const uint32_t span = diskCacheEntrySpan(entry.size);
+			const uint32_t src = entry.offset - sizeof(DiskCacheEntryHeader);
+			if (src != end) {
+				buf.resize(span);
+				if (!readAt(src, buf.data(), span) || !writeAt(end, buf.data(), span)) {
+					return 0;
+				}
+			}
+			entry.offset = end + sizeof(DiskCacheEntryHeader);
+			end += span;
+		}
+
+		const DiskCachePackHeader hdr = {kDiskCacheMagic, kDiskCacheVersion, {0, 0}};
+		if (!writeAt(0, &hdr, sizeof(hdr))) {
+			return 0;
+		}
+		log_info("TextureDiskCache: compacted to %d KB\n", end / 1024);
+		return end;
+	}
+
+	// maps only the range of the entry, view starts at allocation granularity
+	const BYTE *mapEntry(uint32_t offset, uint32_t size) {
+		if (view) {
+			UnmapViewOfFile(view);
+			view = nullptr;
+		}
+		if (offset + size > mapping_size) {
+			if (mapping) {
+				CloseHandle(mapping);
+			}
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			mapping_size = mapping ? file_size : 0;
+			if (!mapping) {
+				log_error("TextureDiskCache: can't map pack (error %d)\n", (int)GetLastError());
+				return nullptr;
+			}
+		}
+		const uint32_t start = offset - offset % granularity;
+		view = MapViewOfFile(mapping, FILE_MAP_READ, 0, start, offset + size - start);
+		if (!view) {
+			log_error("TextureDiskCache: can't map %d KB at %d KB (error %d)\n",
+					  (int)(offset + size - start) / 1024, (int)(start / 1024), (int)GetLastError());
+			return nullptr;
+		}
+		return (const BYTE *)view + (offset - start);
+	}
+
+	void unmap() {
+		if (view) {
+			UnmapViewOfFile(view);
+			view = nullptr;
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+		mapping_size = 0;
+	}
+};
+
+static TextureDiskCache g_disk_cache;
+
+static uint64_t hashBytes(uint64_t h, const BYTE *p, uint32_t size) {
+	const uint64_t kMul = 0x9e3779b97f4a7c15ull;
+	uint32_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t v;
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * kMul;
+		h ^= h >> 29;
+	}
+	for (; i < size; ++i) {
+		h = (h ^ p[i]) * kMul;
 	}
+	return h;
+}
 
-	const BYTE* const start = (BYTE*)dst;
-	BYTE *src = (BYTE *)TexInfo->Mips[mipLevel]->DataPtr;
-	BYTE *srcEnd = src + TexInfo->Mips[mipLevel]->USize * TexInfo->Mips[mipLevel]->VSize;
-	while (src < srcEnd) {
-		*dst = *(DWORD *)&(TexInfo->Palette[*src]);
-		src++;
-		dst++;
+// Everything converted data depends on: engine texture data of all levels, palette as it is used
+// (masking changes it) and resulting format and layout. Without conversion (indices in paletted
+// cache) it is the hash of texture data alone.
+static uint64_t hashMipChainSource(const MipChainSource &src, const RHIBufferImageCopy *regions) {
+	const bool b_convert = src.format->conversionFunc != nullptr;
+	uint64_t hash = 14695981039346656037ull;
+	if (b_convert) {
+		hash = hashBytes(hash, (const BYTE *)src.palette, sizeof(src.palette));
+	}
+	const uint32_t desc[2] = {(uint32_t)src.format->RHIFormat, (uint32_t)src.num_mips};
+	hash = hashBytes(hash, (const BYTE *)desc, sizeof(desc));
+	for (int level = 0; level < src.num_mips; ++level) {
+		const uint32_t w = regions[level].width;
+		const uint32_t h = regions[level].height;
+		const uint32_t dims[2] = {w, h};
+		hash = hashBytes(hash, (const BYTE *)dims, sizeof(dims));
+		// paletted source is a byte per texel
+		hash = hashBytes(hash, src.mips[level], b_convert ? w * h : getMipSize(*src.format, w, h));
 	}
-	assert((BYTE*)dst - start == dst_size);
+	return hash;
+}
 
-	// TODO: restore palette0 color!
+// mips up to this size are hashed whole by diskCacheSignature, bigger ones are sampled
+static const uint32_t kDiskCacheSignatureFullMip = 4096;
+static const uint32_t kDiskCacheSignatureSamples = 256;
+
+// Disk cache lookup runs for every new texture on the render thread, so instead of hashing all
+// texels it takes palette, format, dimensions, small mips whole and spread samples of big ones.
+// Only converted (paletted) textures are cached, source is a byte per texel.
+static uint64_t diskCacheSignature(const MipChainSource &src, const RHIBufferImageCopy *regions) {
+	uint64_t hash = 14695981039346656037ull;
+	hash = hashBytes(hash, (const BYTE *)src.palette, sizeof(src.palette));
+	const uint32_t desc[2] = {(uint32_t)src.format->RHIFormat, (uint32_t)src.num_mips};
+	hash = hashBytes(hash, (const BYTE *)desc, sizeof(desc));
+	for (int level = 0; level < src.num_mips; ++level) {
+		const uint32_t dims[2] = {regions[level].width, regions[level].height};
+		hash = hashBytes(hash, (const BYTE *)dims, sizeof(dims));
+		const uint32_t size = dims[0] * dims[1];
+		if (size <= kDiskCacheSignatureFullMip) {
+			hash = hashBytes(hash, src.mips[level], size);
+			continue;
+		}
+		for (uint32_t i = 0; i < kDiskCacheSignatureSamples; ++i) {
+			const uint32_t offset =
+				(uint32_t)((uint64_t)(size - 8) * i / (kDiskCacheSignatureSamples - 1));
+			hash = hashBytes(hash, src.mips[level] + offset, 8);
+		}
+	}
+	return hash;
+}
+
+// Converts into ordinary memory first, so that the result can be stored without reading back
+// staging (write combined) memory
+static void writeMipChainAndStore(const MipChainSource &src, const RHIBufferImageCopy *regions,
+								  uint32_t size, CacheKey_t key, uint64_t signature, BYTE *dst) {
+	std::vector<BYTE> converted(size);
+	writeMipChain(src, regions, converted.data());
+	g_disk_cache.store(key, signature, converted.data(), size);
+	copyStreaming(dst, converted.data(), size);
+	_mm_sfence();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Conversion workers
+////////////////////////////////////////////////////////////////////////////////
+
+struct TextureConvertJob {
+	MipChainSource src;
+	TextureUploadTask *task;
+	// result goes to the disk cache as well
+	bool b_store;
+	uint64_t disk_signature;
+};
+
+// Jobs are queued under a lock, converted tasks come back through a lock free stack which render
+// thread empties once per frame (see TextureCache::collectConverted)
+struct TextureConvertPool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable cv_job;
+	std::condition_variable cv_idle;
+	std::deque<TextureConvertJob *> jobs;
+	int num_busy = 0;
+	bool b_quit = false;
+	std::atomic<TextureUploadTask *> ready_head{nullptr};
+
+	bool isRunning() const { return !workers.empty(); }
+
+	void start(int num_workers) {
+		assert(workers.empty());
+		b_quit = false;
+		for (int i = 0; i < num_workers; ++i) {
+			workers.emplace_back(&TextureConvertPool::workerLoop, this);
+		}
+	}
+
+	// finishes queued jobs before returning
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			b_quit = true;
+		}
+		cv_job.notify_all();
+		for (std::thread &t : workers) {
+			t.join();
+		}
+		workers.clear();
+	}
+
+	void push(TextureConvertJob *job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		cv_job.notify_one();
+	}
+
+	void waitIdle() {
+		std::unique_lock<std::mutex> lock(mutex);
+		cv_idle.wait(lock, [this] { return jobs.empty() && num_busy == 0; });
+	}
+
+	void pushReady(TextureUploadTask *task) {
+		TextureUploadTask *head = ready_head.load(std::memory_order_relaxed);
+		do {
+			task->next_ready = head;
+		} while (!ready_head.compare_exchange_weak(head, task, std::memory_order_release,
+												   std::memory_order_relaxed));
+	}
+
+	// takes all converted tasks at once, so there is no ABA problem with a single consumer
+	TextureUploadTask *takeReady() {
+		return ready_head.exchange(nullptr, std::memory_order_acquire);
+	}
+
+	void workerLoop() {
+		for (;;) {
+			TextureConvertJob *job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv_job.wait(lock, [this] { return b_quit || !jobs.empty(); });
+				if (jobs.empty()) {
+					return;
+				}
+				job = jobs.front();
+				jobs.pop_front();
+				num_busy++;
+			}
+
+			TextureUploadTask *task = job->task;
+			BYTE *staging = (BYTE *)task->img_staging_buf->MappedPtr();
+			if (job->b_store) {
+				writeMipChainAndStore(job->src, task->mips, task->size, task->cache_id,
+									  job->disk_signature, staging);
+			} else {
+				writeMipChain(job->src, task->mips, staging);
+			}
+			delete job;
+			pushReady(task);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				num_busy--;
+				if (jobs.empty() && num_busy == 0) {
+					cv_idle.notify_all();
+				}
+			}
+		}
+	}
+};
+
+static TextureConvertPool g_convert_pool;
+
 static TextureMetaData buildMetaData(const FTextureInfo *TexInfo, DWORD PolyFlags,
 									 DWORD customPolyFlags) {
 	TextureMetaData metadata;
@@ -174,27 +845,158 @@ const IRHIImageView* TextureCache::get(CacheKey_t id) const {
 	return tc->thash[id].view;
 }
 
+bool TextureCache::isPending(CacheKey_t id) const {
+	assert(isCached(id));
+	return tc->thash[id].pending;
+}
+
 bool TextureCache::isMasked(CacheKey_t id) const {
 	assert(isCached(id));
 	return tc->thash[id].metadata.masked;
 }
 
+static IRHIImageView* createFullView(IRHIDevice *dev, IRHIImage *image) {
+	RHIImageViewDesc iv_desc;
+	iv_desc.image = image;
+	iv_desc.viewType = RHIImageViewType::k2d;
+	iv_desc.format = image->GetDesc().format;
+	iv_desc.subresourceRange.aspectMask = RHIImageAspectFlags::kColor;
+	iv_desc.subresourceRange.baseArrayLayer = 0;
+	iv_desc.subresourceRange.baseMipLevel = 0;
+	iv_desc.subresourceRange.layerCount = 1;
+	iv_desc.subresourceRange.levelCount = image->GetDesc().numMips;
+	return dev->CreateImageView(&iv_desc);
+}
+
+static void createImageRing(IRHIDevice *dev, CachedTexture &ct) {
+	const int ring_size = (int)dev->GetNumBufferedFrames();
+	assert(ring_size <= kMaxRingImages);
+	ct.ring_image[0] = ct.image;
+	ct.ring_view[0] = ct.view;
+	for (int i = 1; i < ring_size; ++i) {
+		ct.ring_image[i] = dev->CreateImage(&ct.image->GetDesc(), RHIImageLayout::kUndefined,
+											RHIMemoryPropertyFlagBits::kDeviceLocal);
+		assert(ct.ring_image[i]);
+		ct.ring_view[i] = createFullView(dev, ct.ring_image[i]);
+		assert(ct.ring_view[i]);
+	}
+	ct.ring_size = ring_size;
+	ct.ring_cur = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// GPU palette decode
+////////////////////////////////////////////////////////////////////////////////
+
+// Paletted cache (see TextureCache::makeCache) keeps TEXF_P8 textures as they are, R8_UINT indices,
+// and their palettes as rows of one shared image. Shader looks colours up and filters them itself.
+// Rows are handed out by the paletted cache and reused once it is destroyed.
+// Like realtime textures the table has one image per frame in flight: animated palettes change rows
+// every frame, and rewriting the image frames still on GPU sample would make upload wait for them.
+enum { kPaletteRows = 4096 };
+
+struct PaletteTable {
+	// current image of the ring, the one draws of this frame sample
+	IRHIImage *image = nullptr;
+	IRHIImageView *view = nullptr;
+	IRHIImage *ring_image[kMaxRingImages];
+	IRHIImageView *ring_view[kMaxRingImages];
+	int ring_size = 0;
+	int ring_cur = 0;
+	// CPU copy of all rows, uploaded once per frame if any of them changed (see uploadPalettes)
+	std::vector<DWORD> rows;
+	int num_rows = 0;
+	bool b_dirty = false;
+	bool b_full = false;
+
+	void create(IRHIDevice *dev) {
+		RHIImageDesc img_desc;
+		img_desc.type = RHIImageType::k2D;
+		// same texels as Paletted2RGBA8 produces
+		img_desc.format = g_format_reg[TEXF_P8].RHIFormat;
+		img_desc.width = 256;
+		img_desc.height = kPaletteRows;
+		img_desc.depth = 1;
+		img_desc.arraySize = 1;
+		img_desc.numMips = 1;
+		img_desc.numSamples = RHISampleCount::k1Bit;
+		img_desc.tiling = RHIImageTiling::kOptimal;
+		img_desc.usage = RHIImageUsageFlagBits::SampledBit | RHIImageUsageFlagBits::TransferDstBit;
+		img_desc.sharingMode = RHISharingMode::kExclusive;
+		ring_size = (int)dev->GetNumBufferedFrames();
+		assert(ring_size <= kMaxRingImages);
+		for (int i = 0; i < ring_size; ++i) {
+			ring_image[i] = dev->CreateImage(&img_desc, RHIImageLayout::kUndefined,
+											 RHIMemoryPropertyFlagBits::kDeviceLocal);
+			assert(ring_image[i]);
+			ring_view[i] = createFullView(dev, ring_image[i]);
+			assert(ring_view[i]);
+		}
+		ring_cur = 0;
+		image = ring_image[0];
+		view = ring_view[0];
+		rows.resize(256 * kPaletteRows);
+	}
+
+	// -1 if table is full
+	int alloc(IRHIDevice *dev, const DWORD *palette) {
+		if (!image) {
+			create(dev);
+		}
+		if (num_rows == kPaletteRows) {
+			if (!b_full) {
+				log_error("TextureCache: palette table is full, next textures are expanded on CPU\n");
+				b_full = true;
+			}
+			return -1;
+		}
+		const int row = num_rows++;
+		memcpy(&rows[row * 256], palette, 256 * sizeof(DWORD));
+		b_dirty = true;
+		return row;
+	}
+
+	void set(int row, const DWORD *palette) {
+		assert(row >= 0 && row < num_rows);
+		if (memcmp(&rows[row * 256], palette, 256 * sizeof(DWORD))) {
+			memcpy(&rows[row * 256], palette, 256 * sizeof(DWORD));
+			b_dirty = true;
+		}
+	}
+
+	void reset() {
+		num_rows = 0;
+		b_full = false;
+		b_dirty = false;
+	}
+};
+
+static PaletteTable g_palettes;
+
+// TEXF_P8 in the paletted cache: indices are copied as they are
+static const TextureFormat g_paletted_index_format = {true, 0, 0, true, RHIFormat::kR8_UINT, nullptr};
+
 bool TextureCache::cache(FTextureInfo *TexInfo, DWORD PolyFlags, IRHIDevice *dev, TextureUploadTask** task) {
 
 	// TODO: can't this just be an assert?
-	if (TexInfo->Format > TEXF_RGBA8) {
+	if ((int)TexInfo->Format >= ARRAY_COUNT(g_format_reg)) {
 		log_error("TextureCache: Unknown texture format TEXF_*: %d!\n", TexInfo->Format);
 		return false;
 	}
 
-	const TextureFormat &format = g_format_reg[(int)TexInfo->Format];
+	const TextureFormat &engine_format = g_format_reg[(int)TexInfo->Format];
 	if((int)TexInfo->Format > TEXF_RGBA7) {
 		int asdf =0;
 	}
-	if (format.b_is_supported == false) {
+	if (engine_format.b_is_supported == false) {
 		log_error("Texture type <%d> is unsupported (yet?).\n", TexInfo->Format);
 		return false;
 	}
+	if (isBlockCompressed(engine_format) && !dev->GetProperties().textureCompressionBC) {
+		log_error("Texture type <%d> is block compressed but device does not support BC formats.\n",
+				  TexInfo->Format);
+		return false;
+	}
 
 	// Unreal 1 S3TC texture fix: if texture info size doesn't match mip size (happens for some
 	// textures for some reason), scale up clamp (which is what we use for the size)
@@ -222,8 +1024,28 @@ bool TextureCache::cache(FTextureInfo *TexInfo, DWORD PolyFlags, IRHIDevice *dev
 	// Some third party s3tc textures report more mips than the info structure fits
 	TexInfo->NumMips = clamp(TexInfo->NumMips, 0, MAX_MIPS);
 
-	// convert only top mip for now
-	MipInfo mip_data = convertMip(TexInfo, format, PolyFlags, 0);
+	// paletted cache keeps indices, palette goes to a row of PaletteTable
+	int palette_row = -1;
+	if (tc->b_paletted && TexInfo->Format == TEXF_P8) {
+		DWORD palette[256];
+		getPalette(TexInfo, PolyFlags, palette);
+		palette_row = g_palettes.alloc(dev, palette);
+	}
+	const TextureFormat &format = palette_row >= 0 ? g_paletted_index_format : engine_format;
+
+	// all mips go to one staging allocation and are copied in one go
+	const int num_mips = getNumUploadMips(TexInfo);
+	RHIBufferImageCopy regions[TextureUploadTask::kMaxMips];
+	const int size = layoutMipChain(TexInfo, format, num_mips, regions);
+
+	// engine did not provide all mips (procedural, some imported textures), generate missing ones
+	// from the last uploaded one while uploading
+	int num_image_mips = num_mips;
+	const int num_full_mips =
+		getNumFullChainMips(TexInfo->Mips[0]->USize, TexInfo->Mips[0]->VSize);
+	if (num_mips < num_full_mips && dev->CanGenerateMips(format.RHIFormat)) {
+		num_image_mips = num_full_mips;
+	}
 
 	RHIImageDesc img_desc;
 	img_desc.type = RHIImageType::k2D;
@@ -232,10 +1054,13 @@ bool TextureCache::cache(FTextureInfo *TexInfo, DWORD PolyFlags, IRHIDevice *dev
 	img_desc.height = TexInfo->Mips[0]->VSize;
 	img_desc.depth = 1;
 	img_desc.arraySize = 1;
-	img_desc.numMips = 1;
+	img_desc.numMips = num_image_mips;
 	img_desc.numSamples = RHISampleCount::k1Bit;
 	img_desc.tiling = RHIImageTiling::kOptimal;
 	img_desc.usage = RHIImageUsageFlagBits::SampledBit | RHIImageUsageFlagBits::TransferDstBit;
+	if (num_image_mips > num_mips) {
+		img_desc.usage |= RHIImageUsageFlagBits::TransferSrcBit;
+	}
 	img_desc.sharingMode = RHISharingMode::kExclusive; // only in graphics queue
 
 	// TODO: why do we need this initial image layout of it only can be undefined or preinitialized?
@@ -244,25 +1069,54 @@ bool TextureCache::cache(FTextureInfo *TexInfo, DWORD PolyFlags, IRHIDevice *dev
 	assert(image);
 	//log_error("Failed to create GPU texture for: %s\n", TexInfo->Texture->GetFullName());
 
-	RHIImageViewDesc iv_desc;
-	iv_desc.image = image;
-	iv_desc.viewType = RHIImageViewType::k2d;
-    iv_desc.format = img_desc.format;
-	iv_desc.subresourceRange.aspectMask = RHIImageAspectFlags::kColor;
-	iv_desc.subresourceRange.baseArrayLayer = 0;
-	iv_desc.subresourceRange.baseMipLevel = 0;
-	iv_desc.subresourceRange.layerCount = 1;
-	iv_desc.subresourceRange.levelCount = 1;
-
-	IRHIImageView* view = dev->CreateImageView(&iv_desc);
+	IRHIImageView* view = createFullView(dev, image);
 	assert(view);
 
-	tc->thash.insert(std::make_pair(TexInfo->CacheID, CachedTexture{ metadata, image, view}));
-
-	*task = TextureUploadTask::make(image, view, false, mip_data.size, mip_data.pSysMem, dev);
-
-	if (mip_data.b_owns_memory) {
-		delete[] mip_data.pSysMem;
+	MipChainSource src;
+	fillMipChainSource(TexInfo, format, PolyFlags, num_mips, src);
+
+	// only conversion is worth caching on disk or moving off this thread, direct formats are a
+	// single copy
+	const bool b_convert = format.conversionFunc && !TexInfo->bRealtime;
+	const bool b_disk = b_convert && g_disk_cache.isOpen();
+	const uint64_t disk_signature = b_disk ? diskCacheSignature(src, regions) : 0;
+	const BYTE *disk_data =
+		b_disk ? g_disk_cache.find(TexInfo->CacheID, disk_signature, size) : nullptr;
+	// conversion pool is shared and its results are collected by the RGBA cache, textures which did
+	// not get a palette row are converted here
+	// GPU expansion needs no conversion here, so nothing is stored on disk for such textures
+	const bool b_gpu_expand = b_convert && !disk_data && (uint32_t)size <= g_gpu_expansion_max_size;
+	const bool b_async =
+		b_convert && !disk_data && !b_gpu_expand && g_convert_pool.isRunning() && !tc->b_paletted;
+
+	CachedTexture ct = {metadata, image, view, num_mips, b_async};
+	ct.palette_row = palette_row;
+	// only realtime textures are ever updated
+	ct.index_hash = (palette_row >= 0 && TexInfo->bRealtime) ? hashMipChainSource(src, regions) : 0;
+	tc->thash.insert(std::make_pair(TexInfo->CacheID, ct));
+
+	const int staging_size = b_gpu_expand ? getExpansionSourceSize(size) : size;
+	*task = TextureUploadTask::make(image, view, false, staging_size, regions, num_mips, dev);
+	BYTE *staging = (BYTE *)(*task)->img_staging_buf->MappedPtr();
+	if (disk_data) {
+		copyStreaming(staging, disk_data, size);
+		_mm_sfence();
+	} else if (b_gpu_expand) {
+		writeExpansionSource(src, regions, staging);
+		(*task)->expanded_size = size;
+	} else if (b_async) {
+		TextureConvertJob *job = new TextureConvertJob;
+		job->src = src;
+		job->task = *task;
+		job->b_store = b_disk;
+		job->disk_signature = disk_signature;
+		(*task)->state = TextureUploadTask::kConverting;
+		(*task)->cache_id = TexInfo->CacheID;
+		g_convert_pool.push(job);
+	} else if (b_disk) {
+		writeMipChainAndStore(src, regions, size, TexInfo->CacheID, disk_signature, staging);
+	} else {
+		writeMipChain(src, regions, staging);
 	}
 
 	return true;
@@ -271,34 +1125,126 @@ bool TextureCache::cache(FTextureInfo *TexInfo, DWORD PolyFlags, IRHIDevice *dev
 bool TextureCache::update(const struct FTextureInfo* TexInfo, unsigned long PolyFlags,
 						  class IRHIDevice *dev, struct TextureUploadTask **task) {
 
-	check(TexInfo->Format <= TEXF_RGBA8);
-	const TextureFormat &format = g_format_reg[(int)TexInfo->Format];
-	check(format.b_is_supported == true);
-
+	check((int)TexInfo->Format < ARRAY_COUNT(g_format_reg));
 	assert(tc->thash.count(TexInfo->CacheID));
-	CachedTexture ct = tc->thash[TexInfo->CacheID];
+	CachedTexture &ct = tc->thash[TexInfo->CacheID];
+	assert(!ct.pending);
+
+	const TextureFormat &format =
+		ct.palette_row >= 0 ? g_paletted_index_format : g_format_reg[(int)TexInfo->Format];
+	check(format.b_is_supported == true);
 
 	TextureMetaData metadata = buildMetaData(TexInfo, PolyFlags, 0);
-	MipInfo mip_data = convertMip(TexInfo, format, PolyFlags, 0);
 	assert(memcmp(&metadata, &ct.metadata, sizeof(TextureMetaData)) == 0);
 
-	*task = TextureUploadTask::make(ct.image, ct.view, true, mip_data.size, mip_data.pSysMem, dev);
+	RHIBufferImageCopy regions[TextureUploadTask::kMaxMips];
+	const int size = layoutMipChain(TexInfo, format, ct.num_mips, regions);
+	MipChainSource src;
+	fillMipChainSource(TexInfo, format, PolyFlags, ct.num_mips, src);
+
+	// palette change alone only uploads the palette table (see uploadPalettes)
+	if (ct.palette_row >= 0) {
+		DWORD palette[256];
+		getPalette(TexInfo, PolyFlags, palette);
+		g_palettes.set(ct.palette_row, palette);
+		const uint64_t index_hash = hashMipChainSource(src, regions);
+		if (index_hash == ct.index_hash) {
+			return false;
+		}
+		ct.index_hash = index_hash;
+	}
 
-	if (mip_data.b_owns_memory) {
-		delete[] mip_data.pSysMem;
+	// one rotation per frame at most, otherwise ring could wrap onto an image still in flight
+	const uint32_t frame = dev->GetCurrentFrame();
+	if (ct.ring_size && ct.last_update_frame == frame) {
+		return false;
+	}
+	if (!ct.ring_size) {
+		createImageRing(dev, ct);
 	}
+	ct.ring_cur = (ct.ring_cur + 1) % ct.ring_size;
+	ct.image = ct.ring_image[ct.ring_cur];
+	ct.view = ct.ring_view[ct.ring_cur];
+	ct.last_update_frame = frame;
+
+	// not an update as far as barriers go: previous contents are discarded and no earlier work
+	// has to be waited for
+	*task = TextureUploadTask::make(ct.image, ct.view, false, size, regions, ct.num_mips, dev);
+	writeMipChain(src, regions, (BYTE *)(*task)->img_staging_buf->MappedPtr());
 
 	return true;
 }
 
 
-TextureCache *TextureCache::makeCache() {
+TextureCache *TextureCache::makeCache(bool b_paletted) {
 	TextureCache* tc = new TextureCache();
 	tc->tc = new CacheImpl;
+	tc->tc->b_paletted = b_paletted;
 	return tc;
 }
 
+int TextureCache::getPaletteRow(CacheKey_t id) const {
+	assert(isCached(id));
+	return tc->thash[id].palette_row;
+}
+
+const IRHIImageView *TextureCache::getPaletteView() const {
+	return g_palettes.view;
+}
+
+bool TextureCache::uploadPalettes(IRHIDevice *dev, TextureUploadTask **task) {
+	if (!g_palettes.b_dirty) {
+		return false;
+	}
+	// next image of the ring was last sampled by a frame that has already finished, all rows in
+	// use are written to it, so like realtime textures it is not an update as far as barriers go
+	PaletteTable &pt = g_palettes;
+	pt.ring_cur = (pt.ring_cur + 1) % pt.ring_size;
+	pt.image = pt.ring_image[pt.ring_cur];
+	pt.view = pt.ring_view[pt.ring_cur];
+	const RHIBufferImageCopy region = {0, 0, 256, (uint32_t)pt.num_rows, 0, 0};
+	const int size = pt.num_rows * 256 * sizeof(DWORD);
+	*task = TextureUploadTask::make(pt.image, pt.view, false, size, &region, 1, dev);
+	copyStreaming((BYTE *)(*task)->img_staging_buf->MappedPtr(), (const BYTE *)pt.rows.data(),
+				  size);
+	_mm_sfence();
+	pt.b_dirty = false;
+	return true;
+}
+
+void TextureCache::collectConverted(std::vector<TextureUploadTask *> &tasks) {
+	for (TextureUploadTask *t = g_convert_pool.takeReady(); t;) {
+		TextureUploadTask *next = t->next_ready;
+		assert(t->state == TextureUploadTask::kConverting);
+		assert(tc->thash.count(t->cache_id));
+		tc->thash[t->cache_id].pending = false;
+		t->state = TextureUploadTask::kPending;
+		t->next_ready = nullptr;
+		tasks.push_back(t);
+		t = next;
+	}
+}
+
+void TextureCache::waitConverted() {
+	if (g_convert_pool.isRunning()) {
+		g_convert_pool.waitIdle();
+	}
+}
+
 void TextureCache::destroy(TextureCache *tc) {
+	// conversions write into staging buffers of this cache's textures, let them finish and drop
+	// their uploads as they would be dropped if they were already queued
+	g_convert_pool.waitIdle();
+	for (TextureUploadTask *t = g_convert_pool.takeReady(); t;) {
+		TextureUploadTask *next = t->next_ready;
+		t->next_ready = nullptr;
+		t->release();
+		t = next;
+	}
+	// rows are handed out again by the next paletted cache
+	if (tc->tc->b_paletted) {
+		g_palettes.reset();
+	}
 	//...
 	delete tc;
 }
@@ -314,14 +1260,32 @@ void TextureCache::destroy(TextureCache *tc) {
 // Invariant: should be always sorted
 static std::vector<TextureUploadTask*> g_taskCache;
 
-void texture_upload_task_init() {
+void texture_upload_task_init(bool b_async_conversion, const char *disk_cache_path,
+							  uint32_t gpu_expansion_max_size) {
+	if (disk_cache_path) {
+		g_disk_cache.open(disk_cache_path);
+	}
+	g_gpu_expansion_max_size = gpu_expansion_max_size;
+	if (b_async_conversion) {
+		// leave a core for the game thread
+		const int num_cores = (int)std::thread::hardware_concurrency();
+		const int num_workers = clamp(num_cores - 1, 1, 4);
+		g_convert_pool.start(num_workers);
+		log_info("TextureCache: %d texture conversion workers\n", num_workers);
+	}
 }
 void texture_upload_task_fini() {
+	if (g_convert_pool.isRunning()) {
+		g_convert_pool.stop();
+	}
+	// after workers, they store into it
+	g_disk_cache.close();
 	g_taskCache.clear();
 }
 
 TextureUploadTask *TextureUploadTask::make(class IRHIImage *image, class IRHIImageView *img_view,
-										   bool is_update, int size, const DWORD*data,
+										   bool is_update, int size,
+										   const RHIBufferImageCopy *mips, int num_mips,
 										   IRHIDevice *dev) {
 	TextureUploadTask* task = nullptr;
 	for (int i = 0; i < (int)g_taskCache.size(); ++i)
@@ -336,9 +1300,11 @@ TextureUploadTask *TextureUploadTask::make(class IRHIImage *image, class IRHIIma
 	if (!task) {
 		task = new TextureUploadTask;
 		task->img_copy_event = dev->CreateEvent();;
-		task->img_staging_buf =
-			dev->CreateBuffer(size, RHIBufferUsageFlagBits::kTransferSrcBit,
-							  RHIMemoryPropertyFlagBits::kHostVisible, RHISharingMode::kExclusive);
+		// storage: read by GPU expansion
+		task->img_staging_buf = dev->CreateBuffer(
+			size, RHIBufferUsageFlagBits::kTransferSrcBit | RHIBufferUsageFlagBits::kStorageBufferBit,
+			RHIMemoryPropertyFlagBits::kHostVisible, RHISharingMode::kExclusive);
+		task->readback_buf = nullptr;
 		task->img_staging_buf->Map(dev, 0, size, 0);
 	}
 
@@ -349,12 +1315,17 @@ TextureUploadTask *TextureUploadTask::make(class IRHIImage *image, class IRHIIma
 	task->size = size;
 	task->is_update = is_update;
 	task->state = kPending;
-
-	//TODO: convert right into this staging buf
+	task->cache_id = 0;
+	task->next_ready = nullptr;
+	task->expanded_size = 0;
+	task->expanded_buf = nullptr;
+	task->expanded_offset = 0;
+	assert(num_mips > 0 && num_mips <= kMaxMips);
+	memcpy(task->mips, mips, num_mips * sizeof(RHIBufferImageCopy));
+	task->num_mips = num_mips;
+
+	// caller converts right into this staging buf, never unmap
 	assert(task->img_staging_buf->Size() >= size);
-	memcpy((uint8_t*)task->img_staging_buf->MappedPtr(), data, size);
-	// never unmap
-	//img_staging_buf->Unmap(dev);
 
 	return task;
 }
@@ -367,6 +1338,9 @@ void TextureUploadTask::release() {
 	state = kInvalid;
 	size = -1;
 	is_update = false;
+	num_mips = 0;
+	expanded_size = 0;
+	expanded_buf = nullptr;
 
 	g_taskCache.push_back(this);
 }
@@ -1,18 +1,42 @@
 #pragma once
 
+#include "rhi.h"
+#include <atomic>
+#include <vector>
+
+typedef unsigned __int64 CacheKey_t;
+
 struct TextureUploadTask {
-	enum : unsigned char { kPending = 0, kDone, kInvalid };
+	// kConverting: staging buffer is being filled by a worker, see TextureCache::collectConverted
+	enum : unsigned char { kPending = 0, kDone, kInvalid, kConverting };
+	// same as MAX_MIPS of the engine
+	enum { kMaxMips = 12 };
 	class IRHIImage *image;
 	class IRHIImageView *img_view;
 	class IRHIBuffer *img_staging_buf;
 	class IRHIEvent *img_copy_event;
 	bool is_update;
-	unsigned char state;
+	std::atomic<unsigned char> state;
 	int size;
+	// where each mip level is in the staging buffer
+	RHIBufferImageCopy mips[kMaxMips];
+	int num_mips;
+	// texture being converted and link in the list of converted ones
+	CacheKey_t cache_id;
+	TextureUploadTask *next_ready;
+	// > 0 if staging buffer holds palette and indices (see kExpandIndexOffset) which GPU expands to
+	// this many bytes of texels laid out as "mips"
+	int expanded_size;
+	// set by whoever expands the task, mips are copied from there instead of staging buffer
+	class IRHIBuffer *expanded_buf;
+	uint32_t expanded_offset;
+	// expanded texels copied back for validation, stays with the task when it is reused
+	class IRHIBuffer *readback_buf;
 
+	// staging buffer is left mapped and has to be filled by the caller
 	static TextureUploadTask *make(class IRHIImage *image, class IRHIImageView *img_view,
 								   bool is_update, int size,
-								   const unsigned long*data,
+								   const RHIBufferImageCopy *mips, int num_mips,
 								   class IRHIDevice *dev);
 	void release();
 	void destroy();
@@ -24,7 +48,15 @@ struct TextureUploadTask {
 	TextureUploadTask& operator=(const TextureUploadTask&);
 };
 
-typedef unsigned __int64 CacheKey_t;
+// GPU expansion source in staging buffer: 256 palette entries, then index of each texel at
+// kExpandIndexOffset + (offset of the texel in expanded mip chain) / 4, see expand-palette.comp
+enum { kExpandIndexOffset = 256 * 4 };
+
+// 8 bit palette index -> 32 bit colour, AVX2 version is picked at runtime if CPU supports it.
+// Exposed for "BenchPalette" console command
+typedef void (*PaletteExpandFunc)(const unsigned long *palette, const unsigned char *src,
+								  unsigned long *dst, unsigned int count);
+PaletteExpandFunc getPaletteExpandFunc(bool allow_simd);
 
 class TextureCache {
 	TextureCache() = default;
@@ -36,15 +68,40 @@ class TextureCache {
 	bool isCached(CacheKey_t id) const;
 	const class IRHIImageView *get(CacheKey_t id) const;
 	bool isMasked(CacheKey_t id) const;
-	static TextureCache *makeCache();
+	// texture is still being converted, its view must not be used yet
+	bool isPending(CacheKey_t id) const;
+	// b_paletted: TEXF_P8 textures are stored as 8 bit indices and their palettes as rows of one
+	// image (see getPaletteRow), shader does the lookup
+	static TextureCache *makeCache(bool b_paletted);
 	static void destroy(TextureCache *);
 	bool cache(/*const*/ struct FTextureInfo *tex_info, unsigned long PolyFlags,
 			   class IRHIDevice *dev, struct TextureUploadTask **task);
+	// Writes next image of the texture's ring (see CachedTexture), false if texture was already
+	// updated this frame and there is nothing to upload
 	bool update(const struct FTextureInfo *tex_info, unsigned long PolyFlags, class IRHIDevice *dev,
 				struct TextureUploadTask **task);
+	// appends uploads of textures which finished conversion since last call
+	void collectConverted(std::vector<struct TextureUploadTask *> &tasks);
+	// blocks until all queued conversions are finished
+	void waitConverted();
+	// row of the texture's palette in getPaletteView(), -1 if texture is not stored as indices
+	int getPaletteRow(CacheKey_t id) const;
+	// nullptr until first paletted texture is cached, changes whenever palettes are uploaded
+	const class IRHIImageView *getPaletteView() const;
+	// upload of all palette rows into the next image of the table if any row changed since last
+	// call, false if there is nothing to upload
+	bool uploadPalettes(class IRHIDevice *dev, struct TextureUploadTask **task);
 };
 
 
-void texture_upload_task_init();
+// b_async_conversion: convert new textures on worker threads (see TextureCache::cache)
+// disk_cache_path: pack file of converted textures kept between runs, nullptr to not use it
+// gpu_expansion_max_size: paletted textures up to this size once expanded are expanded by GPU
+// (see TextureUploadTask::expanded_size), 0 to always convert on CPU
+void texture_upload_task_init(bool b_async_conversion, const char *disk_cache_path,
+							  uint32_t gpu_expansion_max_size);
 void texture_upload_task_fini();
+// compares texels read back after GPU expansion with CPU conversion of the same staging contents,
+// returns number of texels which differ
+int texture_validate_expansion(const TextureUploadTask *task);
 
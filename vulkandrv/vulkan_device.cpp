@@ -31,11 +31,13 @@ template<> struct ResImplType<IRHIDescriptorSet> { typedef RHIDescriptorSetVk Ty
 template<> struct ResImplType<IRHIRenderPass> { typedef RHIRenderPassVk Type; };
 template<> struct ResImplType<IRHIFrameBuffer> { typedef RHIFrameBufferVk Type; };
 template<> struct ResImplType<IRHIGraphicsPipeline> { typedef RHIGraphicsPipelineVk Type; };
+template<> struct ResImplType<IRHIComputePipeline> { typedef RHIComputePipelineVk Type; };
 template<> struct ResImplType<IRHIPipelineLayout> { typedef RHIPipelineLayoutVk Type; };
 template<> struct ResImplType<IRHIShader> { typedef RHIShaderVk Type; };
 template<> struct ResImplType<IRHIBuffer> { typedef RHIBufferVk Type; };
 template<> struct ResImplType<IRHIFence> { typedef RHIFenceVk Type; };
 template<> struct ResImplType<IRHIEvent> { typedef RHIEventVk Type; };
+template<> struct ResImplType<IRHIQueryPool> { typedef RHIQueryPoolVk Type; };
 
 template <typename R> 
 typename ResImplType<R>::Type* ResourceCast(R* obj) {
@@ -58,7 +60,11 @@ VkFormat translate(RHIFormat fmt) {
 		VK_FORMAT_R32G32B32_UINT,	 VK_FORMAT_R32G32B32_SINT,	  VK_FORMAT_R32G32B32_SFLOAT,
 		VK_FORMAT_R32G32B32A32_UINT, VK_FORMAT_R32G32B32A32_SINT, VK_FORMAT_R32G32B32A32_SFLOAT,
 		VK_FORMAT_B8G8R8A8_UNORM,	 VK_FORMAT_B8G8R8A8_UINT,	  VK_FORMAT_B8G8R8A8_SRGB,
-		VK_FORMAT_D32_SFLOAT,		 VK_FORMAT_D32_SFLOAT_S8_UINT
+		VK_FORMAT_D32_SFLOAT,		 VK_FORMAT_D32_SFLOAT_S8_UINT,
+		VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_SRGB_BLOCK,
+		VK_FORMAT_BC2_UNORM_BLOCK,		VK_FORMAT_BC2_SRGB_BLOCK,
+		VK_FORMAT_BC3_UNORM_BLOCK,		VK_FORMAT_BC3_SRGB_BLOCK,
+		VK_FORMAT_R8_UINT
 	};
 	assert((uint32_t)fmt < countof(formats));
 	return formats[(uint32_t)fmt];
@@ -89,6 +95,13 @@ RHIFormat untranslate(VkFormat fmt) {
 		case VK_FORMAT_B8G8R8A8_SRGB:return RHIFormat::kB8G8R8A8_SRGB;
 		case VK_FORMAT_D32_SFLOAT:return RHIFormat::kD32_SFLOAT;
 		case VK_FORMAT_D32_SFLOAT_S8_UINT:return RHIFormat::kD32_SFLOAT_S8_UINT;
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:return RHIFormat::kBC1_RGBA_UNORM;
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:return RHIFormat::kBC1_RGBA_SRGB;
+		case VK_FORMAT_BC2_UNORM_BLOCK:return RHIFormat::kBC2_UNORM;
+		case VK_FORMAT_BC2_SRGB_BLOCK:return RHIFormat::kBC2_SRGB;
+		case VK_FORMAT_BC3_UNORM_BLOCK:return RHIFormat::kBC3_UNORM;
+		case VK_FORMAT_BC3_SRGB_BLOCK:return RHIFormat::kBC3_SRGB;
+		case VK_FORMAT_R8_UINT:return RHIFormat::kR8_UINT;
         default:
 		    assert(0 && "Incorrect format");
     		return RHIFormat::kUNDEFINED;
@@ -565,6 +578,7 @@ VkBufferUsageFlags translate_buffer_usage(uint32_t usage) {
     vk_usage |= (usage & RHIBufferUsageFlagBits::kUniformBufferBit) ? VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT: 0;
     vk_usage |= (usage & RHIBufferUsageFlagBits::kIndexBufferBit) ? VK_BUFFER_USAGE_INDEX_BUFFER_BIT: 0;
     vk_usage |= (usage & RHIBufferUsageFlagBits::kVertexBufferBit) ? VK_BUFFER_USAGE_VERTEX_BUFFER_BIT: 0;
+    vk_usage |= (usage & RHIBufferUsageFlagBits::kIndirectBufferBit) ? VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT: 0;
     return vk_usage;
 };
 
@@ -1076,6 +1090,40 @@ RHIGraphicsPipelineVk *RHIGraphicsPipelineVk::Create(
 	return vk_pipeline;
 }
 
+////////////// Compute Pipeline ///////////////////////////////////////////////////
+void RHIComputePipelineVk::Destroy(IRHIDevice* device) {
+	RHIDeviceVk* dev = ResourceCast(device);
+	vkDestroyPipeline(dev->Handle(), handle_, dev->Allocator());
+	delete this;
+}
+
+RHIComputePipelineVk *RHIComputePipelineVk::Create(IRHIDevice *device,
+												   const RHIShaderStage *shader_stage,
+												   const IRHIPipelineLayout *i_pipleline_layout) {
+	RHIDeviceVk* dev = ResourceCast(device);
+	assert(shader_stage->stage == RHIShaderStageFlagBits::kCompute);
+	const RHIPipelineLayoutVk* playout = ResourceCast(i_pipleline_layout);
+
+	VkComputePipelineCreateInfo pipeline_create_info = {};
+	pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline_create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline_create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline_create_info.stage.module = ResourceCast(shader_stage->module)->Handle();
+	pipeline_create_info.stage.pName = shader_stage->pEntryPointName;
+	pipeline_create_info.layout = playout->Handle();
+	pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
+	pipeline_create_info.basePipelineIndex = -1;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(dev->Handle(), VK_NULL_HANDLE, 1, &pipeline_create_info,
+								 dev->Allocator(), &pipeline) != VK_SUCCESS) {
+		log_error("Could not create compute pipeline!\n");
+		return nullptr;
+	}
+
+	return new RHIComputePipelineVk(pipeline, playout);
+}
+
 ////////////////////////////////////////////////////////////////////////
 IRHIShader* RHIDeviceVk::CreateShader(RHIShaderStageFlagBits::Value stage, const uint32_t *pdata, uint32_t size) {
     return RHIShaderVk::Create(this, pdata, size, stage);
@@ -1299,6 +1347,47 @@ RHIEventVk *RHIEventVk::Create(IRHIDevice *device) {
 	return event;
 }
 
+/////////////////////// Query pool /////////////////////////////////////////////
+bool RHIQueryPoolVk::GetTimestamps(IRHIDevice *device, uint32_t first, uint32_t count,
+								   uint64_t *results) {
+	assert(first + count <= count_);
+	RHIDeviceVk *dev = ResourceCast(device);
+	VkResult status =
+		vkGetQueryPoolResults(dev->Handle(), handle_, first, count, count * sizeof(uint64_t),
+							  results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	return VK_SUCCESS == status;
+}
+void RHIQueryPoolVk::Destroy(IRHIDevice *device) {
+	RHIDeviceVk *dev = ResourceCast(device);
+	vkDestroyQueryPool(dev->Handle(), handle_, dev->Allocator());
+	delete this;
+}
+
+RHIQueryPoolVk *RHIQueryPoolVk::CreateTimestamps(IRHIDevice *device, uint32_t count) {
+	VkQueryPoolCreateInfo pool_create_info = {
+		VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,			 // VkStructureType                sType
+		nullptr,											 // const void                    *pNext
+		0,													 // VkQueryPoolCreateFlags         flags
+		VK_QUERY_TYPE_TIMESTAMP,							 // VkQueryType                    queryType
+		count,												 // uint32_t                       queryCount
+		0													 // VkQueryPipelineStatisticFlags  pipelineStatistics
+	};
+
+	RHIDeviceVk *dev = ResourceCast(device);
+
+	VkQueryPool vk_pool;
+	if (vkCreateQueryPool(dev->Handle(), &pool_create_info, dev->Allocator(), &vk_pool) !=
+		VK_SUCCESS) {
+		log_error("Could not create a query pool !\n");
+		return nullptr;
+	}
+
+	RHIQueryPoolVk *pool = new RHIQueryPoolVk();
+	pool->handle_ = vk_pool;
+	pool->count_ = count;
+	return pool;
+}
+
 ////////////// Command buffer //////////////////////////////////////////////////
 
 void Barrier(VkCommandBuffer cb, RHIImageVk* image,
@@ -1310,7 +1399,7 @@ void Barrier(VkCommandBuffer cb, RHIImageVk* image,
 	VkImageSubresourceRange image_subresource_range = {
 		VK_IMAGE_ASPECT_COLOR_BIT, // VkImageAspectFlags                     aspectMask
 		0,						   // uint32_t                               baseMipLevel
-		1,						   // uint32_t                               levelCount
+		VK_REMAINING_MIP_LEVELS,   // uint32_t                               levelCount
 		0,						   // uint32_t                               baseArrayLayer
 		1						   // uint32_t                               layerCount
 	};
@@ -1452,6 +1541,12 @@ void RHICmdBufVk::BindPipeline(RHIPipelineBindPoint::Value bind_point, IRHIGraph
     vkCmdBindPipeline(cb_, translate_pbp(bind_point), pipeline->Handle());
 }
 
+void RHICmdBufVk::BindComputePipeline(IRHIComputePipeline* i_pipeline) {
+    assert(is_recording_);
+    const RHIComputePipelineVk* pipeline = ResourceCast(i_pipeline);
+    vkCmdBindPipeline(cb_, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->Handle());
+}
+
 void RHICmdBufVk::BindDescriptorSets(RHIPipelineBindPoint::Value bind_point,
 	const IRHIPipelineLayout* pipeline_layout,
 	const IRHIDescriptorSet*const* desc_sets, uint32_t count, uint32_t dyn_offsets_count, const uint32_t* dyn_offsets) {
@@ -1486,12 +1581,26 @@ void RHICmdBufVk::Draw(uint32_t vertex_count, uint32_t instance_count, uint32_t
     vkCmdDraw(cb_, vertex_count, instance_count, first_vertex, first_instance);
 }
 
+void RHICmdBufVk::Dispatch(uint32_t group_count_x, uint32_t group_count_y,
+						   uint32_t group_count_z) {
+    assert(is_recording_);
+    assert(!is_in_render_pass_);
+    vkCmdDispatch(cb_, group_count_x, group_count_y, group_count_z);
+}
+
 void RHICmdBufVk::DrawIndexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index,
 					  uint32_t vertex_offset, uint32_t first_instance) {
     assert(is_recording_);
 	vkCmdDrawIndexed(cb_, index_count, instance_count, first_index, vertex_offset, first_instance);
 }
 
+void RHICmdBufVk::DrawIndexedIndirect(IRHIBuffer *i_buf, uint32_t offset, uint32_t draw_count,
+									  uint32_t stride) {
+	assert(is_recording_);
+	RHIBufferVk* buf = ResourceCast(i_buf);
+	vkCmdDrawIndexedIndirect(cb_, buf->Handle(), offset, draw_count, stride);
+}
+
 void RHICmdBufVk::BindVertexBuffers(IRHIBuffer** i_vb, uint32_t first_binding, uint32_t count) {
     std::vector<VkBuffer> vbs(count); // :-(
     std::vector<VkDeviceSize> offsets(count); // :-(
@@ -1561,6 +1670,112 @@ void RHICmdBufVk::CopyBufferToImage2D(class IRHIImage*i_dst, class IRHIBuffer *i
 	vkCmdCopyBufferToImage(cb_, buf->Handle(), img->Handle(), img->vk_layout_, 1, &buffer_image_copy_info);
 }
 
+void RHICmdBufVk::CopyBufferToImage2D(class IRHIImage *i_dst, class IRHIBuffer *i_src,
+									  const RHIBufferImageCopy *regions, uint32_t count) {
+	const RHIImageVk* img = ResourceCast(i_dst);
+	const RHIBufferVk* buf = ResourceCast(i_src);
+
+	assert(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL == img->vk_layout_);
+
+	// atlas uploads can have many regions, record them in chunks
+	VkBufferImageCopy copy_info[16];
+	for (uint32_t first = 0; first < count; first += countof(copy_info)) {
+		const uint32_t n = min(count - first, (uint32_t)countof(copy_info));
+		for (uint32_t j = 0; j < n; ++j) {
+			const RHIBufferImageCopy& r = regions[first + j];
+			assert(r.mipLevel < img->GetDesc().numMips);
+			copy_info[j].bufferOffset = r.bufferOffset;
+			copy_info[j].bufferRowLength = 0;
+			copy_info[j].bufferImageHeight = 0;
+			copy_info[j].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			copy_info[j].imageSubresource.mipLevel = r.mipLevel;
+			copy_info[j].imageSubresource.baseArrayLayer = 0;
+			copy_info[j].imageSubresource.layerCount = 1;
+			copy_info[j].imageOffset.x = r.x;
+			copy_info[j].imageOffset.y = r.y;
+			copy_info[j].imageOffset.z = 0;
+			copy_info[j].imageExtent.width = r.width;
+			copy_info[j].imageExtent.height = r.height;
+			copy_info[j].imageExtent.depth = 1;
+		}
+		vkCmdCopyBufferToImage(cb_, buf->Handle(), img->Handle(), img->vk_layout_, n, copy_info);
+	}
+}
+
+
+void RHICmdBufVk::GenerateMips(IRHIImage *image_in, uint32_t first_level) {
+	RHIImageVk* image = ResourceCast(image_in);
+	const uint32_t num_mips = image->GetDesc().numMips;
+
+	assert(first_level > 0 && first_level < num_mips);
+	assert(image->vk_access_flags_ == VK_ACCESS_TRANSFER_WRITE_BIT);
+	assert(image->vk_layout_ == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	VkImageMemoryBarrier barrier = {
+		VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, // VkStructureType                        sType
+		nullptr,								// const void                            *pNext
+		VK_ACCESS_TRANSFER_WRITE_BIT,			// VkAccessFlags                          srcAccessMask
+		VK_ACCESS_TRANSFER_READ_BIT,			// VkAccessFlags                          dstAccessMask
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	// VkImageLayout                          oldLayout
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	// VkImageLayout                          newLayout
+		VK_QUEUE_FAMILY_IGNORED,				// uint32_t                               srcQueueFamilyIndex
+		VK_QUEUE_FAMILY_IGNORED,				// uint32_t                               dstQueueFamilyIndex
+		image->Handle(),						// VkImage                                image
+		{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 } // VkImageSubresourceRange              subresourceRange
+	};
+
+	// levels below first_level were all written by the copy, so flip them to transfer src
+	// with one barrier, after that each generated level needs its own barrier before it is read
+	barrier.subresourceRange.levelCount = first_level;
+	vkCmdPipelineBarrier(cb_, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+						 nullptr, 0, nullptr, 1, &barrier);
+
+	int32_t w = (int32_t)max(image->Width() >> (first_level - 1), 1u);
+	int32_t h = (int32_t)max(image->Height() >> (first_level - 1), 1u);
+	for (uint32_t level = first_level; level < num_mips; ++level) {
+		const int32_t mip_w = max(w / 2, 1);
+		const int32_t mip_h = max(h / 2, 1);
+
+		VkImageBlit blit;
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { w, h, 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { mip_w, mip_h, 1 };
+		vkCmdBlitImage(cb_, image->Handle(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->Handle(),
+					   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		if (level + 1 < num_mips) {
+			barrier.subresourceRange.baseMipLevel = level;
+			barrier.subresourceRange.levelCount = 1;
+			vkCmdPipelineBarrier(cb_, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+								 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+		w = mip_w;
+		h = mip_h;
+	}
+
+	// all levels but the last one are in transfer src now, move everything to shader read in one go
+	VkImageMemoryBarrier to_shader_read[2] = { barrier, barrier };
+	to_shader_read[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	to_shader_read[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	to_shader_read[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	to_shader_read[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	to_shader_read[0].subresourceRange.baseMipLevel = 0;
+	to_shader_read[0].subresourceRange.levelCount = num_mips - 1;
+	to_shader_read[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	to_shader_read[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	to_shader_read[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	to_shader_read[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	to_shader_read[1].subresourceRange.baseMipLevel = num_mips - 1;
+	to_shader_read[1].subresourceRange.levelCount = 1;
+	vkCmdPipelineBarrier(cb_, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+						 0, 0, nullptr, 0, nullptr, 2, to_shader_read);
+
+	image->vk_access_flags_ = VK_ACCESS_SHADER_READ_BIT;
+	image->vk_layout_ = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
 
 void RHICmdBufVk::SetEvent(IRHIEvent* i_event, RHIPipelineStageFlags::Value stage) {
     const RHIEventVk* event = ResourceCast(i_event); 
@@ -1629,6 +1844,47 @@ void RHICmdBufVk::Clear(IRHIImage *image_in, const vec4 &color, uint32_t img_asp
 	}
 }
 
+void RHICmdBufVk::ClearAttachments(uint32_t img_aspect_bits, uint32_t color_attachment,
+								   const RHIClearValue &value, const RHIScissor *rects,
+								   uint32_t rect_count) {
+	assert(is_recording_);
+	assert(rects && rect_count);
+
+	VkClearAttachment att;
+	att.aspectMask = translate_image_aspect(img_aspect_bits);
+	att.colorAttachment = color_attachment;
+	if (img_aspect_bits & RHIImageAspectFlags::kColor) {
+		att.clearValue.color = {{value.colour.x, value.colour.y, value.colour.z, value.colour.w}};
+	} else {
+		att.clearValue.depthStencil.depth = value.depth;
+		att.clearValue.depthStencil.stencil = value.stencil;
+	}
+
+	std::vector<VkClearRect> clear_rects(rect_count);
+	for (uint32_t i = 0; i < rect_count; ++i) {
+		clear_rects[i].rect.offset = {rects[i].x, rects[i].y};
+		clear_rects[i].rect.extent = {(uint32_t)rects[i].width, (uint32_t)rects[i].height};
+		clear_rects[i].baseArrayLayer = 0;
+		clear_rects[i].layerCount = 1;
+	}
+
+	vkCmdClearAttachments(cb_, 1, &att, rect_count, clear_rects.data());
+}
+
+void RHICmdBufVk::ResetQueryPool(IRHIQueryPool *i_pool, uint32_t first, uint32_t count) {
+	assert(is_recording_ && !is_in_render_pass_);
+	const RHIQueryPoolVk* pool = ResourceCast(i_pool);
+	vkCmdResetQueryPool(cb_, pool->Handle(), first, count);
+}
+
+void RHICmdBufVk::WriteTimestamp(IRHIQueryPool *i_pool, RHIPipelineStageFlags::Value stage,
+								 uint32_t query) {
+	assert(is_recording_);
+	const RHIQueryPoolVk* pool = ResourceCast(i_pool);
+	assert(query < pool->Count());
+	vkCmdWriteTimestamp(cb_, (VkPipelineStageFlagBits)translate_ps(stage), pool->Handle(), query);
+}
+
 void RHICmdBufVk::Barrier_ClearToPresent(IRHIImage *image_in) {
 	RHIImageVk* image = ResourceCast(image_in);
 	Barrier(this->Handle(), image, VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -1690,6 +1946,23 @@ void RHICmdBufVk::Barrier_ShaderReadToTransfer(IRHIImage *image_in) {
 
 ////////////////RHI Device /////////////////////////////////////////////////////
 
+void RHIDeviceVk::query_format_features() {
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+										  VK_FORMAT_FEATURE_BLIT_DST_BIT |
+										  VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	can_generate_mips_[0] = false;
+	for (uint32_t f = 1; f < (uint32_t)RHIFormat::kCount; ++f) {
+		VkFormatProperties props;
+		vkGetPhysicalDeviceFormatProperties(dev_.phys_device_, translate_f((RHIFormat)f), &props);
+		can_generate_mips_[f] = (props.optimalTilingFeatures & required) == required;
+	}
+}
+
+bool RHIDeviceVk::CanGenerateMips(RHIFormat fmt) const {
+	assert((uint32_t)fmt < (uint32_t)RHIFormat::kCount);
+	return can_generate_mips_[(uint32_t)fmt];
+}
+
 // should this be mobved to command buffer class / .cpp file and just pass Device as a parameter ?
 IRHICmdBuf* RHIDeviceVk::CreateCommandBuffer(RHIQueueType::Value queue_type) {
 
@@ -2239,6 +2512,11 @@ IRHIGraphicsPipeline *RHIDeviceVk::CreateGraphicsPipeline(
 										 dynamic_state, dynamic_state_count, i_render_pass);
 }
 
+IRHIComputePipeline *RHIDeviceVk::CreateComputePipeline(const RHIShaderStage *shader_stage,
+														const IRHIPipelineLayout *i_pipleline_layout) {
+	return RHIComputePipelineVk::Create(this, shader_stage, i_pipleline_layout);
+}
+
 IRHIPipelineLayout *
 RHIDeviceVk::CreatePipelineLayout(const IRHIDescriptorSetLayout *const *desc_set_layout,
 								  uint32_t count) {
@@ -2258,6 +2536,10 @@ IRHIEvent *RHIDeviceVk::CreateEvent() {
 	return RHIEventVk::Create(this);
 };
 
+IRHIQueryPool *RHIDeviceVk::CreateTimestampQueryPool(uint32_t count) {
+	return RHIQueryPoolVk::CreateTimestamps(this, count);
+};
+
 
 bool RHIDeviceVk::BeginFrame() {
 	cur_frame_++;
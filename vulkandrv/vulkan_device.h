@@ -53,6 +53,7 @@ struct VulkanDevice {
 	VkDebugUtilsMessengerEXT debug_messenger_;
 	VkPhysicalDevice phys_device_;// = VK_NULL_HANDLE;
 	VkPhysicalDeviceProperties vk_phys_device_prop_;
+	VkPhysicalDeviceFeatures vk_phys_device_features_;
 	RHIPhysDeviceProperties phys_device_prop_;
 	SwapChainData swap_chain_data_;
 	SwapChain swap_chain_;
@@ -208,6 +209,21 @@ public:
 	}
 };
 
+////////////////////////////////////////////////////////////////////////////////
+class RHIComputePipelineVk: public IRHIComputePipeline {
+	VkPipeline handle_;
+	const RHIPipelineLayoutVk* const layout_;
+public:
+	void Destroy(IRHIDevice *device);
+	static RHIComputePipelineVk *Create(IRHIDevice *device, const RHIShaderStage *shader_stage,
+										const IRHIPipelineLayout *pipleline_layout);
+
+	RHIComputePipelineVk(VkPipeline pipeline, const RHIPipelineLayoutVk *playout)
+		: handle_(pipeline), layout_(playout) {}
+	VkPipeline Handle() const { return handle_; }
+	const IRHIPipelineLayout* Layout() const { return layout_; }
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 class RHIBufferVk : public IRHIBuffer {
     VkBuffer handle_;
@@ -271,6 +287,21 @@ class RHIEventVk: public IRHIEvent {
         static RHIEventVk* Create(IRHIDevice *device);
 };
 
+////////////////////////////////////////////////////////////////////////////////
+class RHIQueryPoolVk: public IRHIQueryPool {
+        VkQueryPool handle_;
+        uint32_t count_;
+    public:
+        virtual bool GetTimestamps(IRHIDevice *device, uint32_t first, uint32_t count,
+                                   uint64_t *results) ;
+        virtual void Destroy(IRHIDevice *device) ;
+
+        VkQueryPool Handle() const { return handle_; }
+        uint32_t Count() const { return count_; }
+
+        static RHIQueryPoolVk* CreateTimestamps(IRHIDevice *device, uint32_t count);
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 class RHICmdBufVk: public IRHICmdBuf {
 	VkCommandBuffer cb_;
@@ -303,6 +334,8 @@ public:
 					  uint32_t first_instance);
 	virtual void DrawIndexed(uint32_t index_count, uint32_t instance_count, uint32_t first_index,
 							 uint32_t vertex_offset, uint32_t first_instance);
+	virtual void DrawIndexedIndirect(IRHIBuffer *i_buf, uint32_t offset, uint32_t draw_count,
+									 uint32_t stride);
 
     virtual void BindVertexBuffers(IRHIBuffer** i_vb, uint32_t first_binding, uint32_t count) ;
 	virtual void BindIndexBuffer(IRHIBuffer* i_ib, uint32_t offset, RHIIndexType type);
@@ -311,6 +344,9 @@ public:
 							uint32_t src_offset, uint32_t size) ;
 
 	virtual void CopyBufferToImage2D(class IRHIImage *i_dst, class IRHIBuffer *i_src);
+	virtual void CopyBufferToImage2D(class IRHIImage *i_dst, class IRHIBuffer *i_src,
+									 const RHIBufferImageCopy *regions, uint32_t count);
+	virtual void GenerateMips(class IRHIImage *image, uint32_t first_level);
 
     virtual void SetEvent(IRHIEvent* event, RHIPipelineStageFlags::Value stage) ;
     virtual void ResetEvent(IRHIEvent* event, RHIPipelineStageFlags::Value stage) ;
@@ -322,7 +358,15 @@ public:
 	virtual void Clear(IRHIImage *image_in, const vec4 &color, uint32_t img_aspect_bits,
 					   IRHIImage *ds_image_in, float depth, uint32_t stencil,
 					   uint32_t ds_img_aspect_bits);
+	virtual void ClearAttachments(uint32_t img_aspect_bits, uint32_t color_attachment,
+								  const RHIClearValue &value, const RHIScissor *rects,
+								  uint32_t rect_count);
+	virtual void ResetQueryPool(IRHIQueryPool *pool, uint32_t first, uint32_t count);
+	virtual void WriteTimestamp(IRHIQueryPool *pool, RHIPipelineStageFlags::Value stage,
+								uint32_t query);
 	virtual void BindPipeline(RHIPipelineBindPoint::Value bind_point, IRHIGraphicsPipeline* pipeline) ;
+	virtual void BindComputePipeline(IRHIComputePipeline* pipeline);
+	virtual void Dispatch(uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z);
 	virtual void BindDescriptorSets(RHIPipelineBindPoint::Value bind_point,
 									const IRHIPipelineLayout* pipeline_layout,
 									const IRHIDescriptorSet *const *desc_sets, uint32_t count,
@@ -382,10 +426,16 @@ class RHIDeviceVk: public IRHIDevice {
 	fpOnSwapChainRecreated fp_swap_chain_recreated_;
 	void* user_ptr_;
 
+	// format features do not change, so they are queried once, see CanGenerateMips()
+	bool can_generate_mips_[(uint32_t)RHIFormat::kCount];
+	void query_format_features();
+
 public:
 	explicit RHIDeviceVk(VulkanDevice &device)
 		: dev_(device), prev_frame_(-1), cur_frame_(-1), cur_swap_chain_img_idx_(0xffffffff),
-		  between_begin_frame(false), fp_swap_chain_recreated_(nullptr), user_ptr_(nullptr) {}
+		  between_begin_frame(false), fp_swap_chain_recreated_(nullptr), user_ptr_(nullptr) {
+		query_format_features();
+	}
 
 	// interface implementation
 	virtual ~RHIDeviceVk() {};
@@ -403,6 +453,7 @@ public:
 
     virtual IRHIFence* CreateFence(bool create_signalled) ;
     virtual IRHIEvent* CreateEvent() ;
+    virtual IRHIQueryPool* CreateTimestampQueryPool(uint32_t count) ;
 
     virtual IRHIGraphicsPipeline *CreateGraphicsPipeline(
             const RHIShaderStage *shader_stage, uint32_t shader_stage_count,
@@ -413,6 +464,8 @@ public:
             const RHIColorBlendState *color_blend_state, const IRHIPipelineLayout *i_pipleline_layout,
             const RHIDynamicState::Value* dynamic_state, const uint32_t dynamic_state_count,
             const IRHIRenderPass *i_render_pass) ;
+    virtual IRHIComputePipeline *CreateComputePipeline(const RHIShaderStage *shader_stage,
+                                                       const IRHIPipelineLayout *i_pipleline_layout);
 
     virtual IRHIPipelineLayout* CreatePipelineLayout(const IRHIDescriptorSetLayout*const* desc_set_layout, uint32_t count);
     virtual IRHIShader* CreateShader(RHIShaderStageFlagBits::Value stage, const uint32_t *pdata, uint32_t size);
@@ -446,6 +499,7 @@ public:
 	const RHIPhysDeviceProperties& GetProperties() const override {
 		return dev_.phys_device_prop_;	
 	}
+	bool CanGenerateMips(RHIFormat fmt) const override;
 
 
     virtual void WaitIdle() override;
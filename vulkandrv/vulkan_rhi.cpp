@@ -4,6 +4,8 @@
 //#define VK_USE_PLATFORM_WIN32_KHR
 //#include "glad/vulkan.h"
 //#include "flext/flextVk.h"
+// VK_KHR_portability_subset
+#define VK_ENABLE_BETA_EXTENSIONS
 #include <vulkan/vulkan.h>
 
 #include "vulkan_rhi.h"
@@ -153,6 +155,20 @@ bool check_device_extensions(VkPhysicalDevice phys_device, const std::vector<con
 	return true;
 }
 
+bool is_device_extension_supported(VkPhysicalDevice phys_device, const char* ext_name) {
+	uint32_t count = 0;
+	vkEnumerateDeviceExtensionProperties(phys_device, nullptr, &count, nullptr);
+
+	std::vector<VkExtensionProperties> extensions(count);
+	if (vkEnumerateDeviceExtensionProperties(phys_device, nullptr, &count, extensions.data()) != VK_SUCCESS) {
+		return false;
+	}
+	return extensions.end() !=
+		   std::find_if(extensions.begin(), extensions.end(), [ext_name](VkExtensionProperties prop) {
+			   return 0 == strcmp(prop.extensionName, ext_name);
+		   });
+}
+
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL
 debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -365,7 +381,9 @@ bool is_device_suitable(VkPhysicalDevice device, VkPhysicalDeviceProperties prop
 		check_device_extensions(device, req_device_ext) && swap_chain_ok;
 }
 
-bool pick_phys_device(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice& phys_device, VkPhysicalDeviceProperties& phys_device_prop) {
+bool pick_phys_device(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevice& phys_device,
+					  VkPhysicalDeviceProperties& phys_device_prop,
+					  VkPhysicalDeviceFeatures& phys_device_features) {
 
     GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceSupportKHR);
     GET_INSTANCE_PROC_ADDR(instance, GetPhysicalDeviceSurfaceCapabilitiesKHR);
@@ -401,6 +419,7 @@ bool pick_phys_device(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevic
 		if (is_device_suitable(device, props.properties, features.features, surface) && picked_name.empty()) {
 			phys_device = device;
 			phys_device_prop = props.properties;
+			phys_device_features = features.features;
 			picked_name = props.properties.deviceName;
 		}
 		log_info("Phys device: %s\n", props.properties.deviceName);
@@ -414,7 +433,11 @@ bool pick_phys_device(VkInstance instance, VkSurfaceKHR surface, VkPhysicalDevic
 }
 
 
-bool create_logical_device(VkPhysicalDevice phys_device, QueueFamilies qf, VkAllocationCallbacks* pallocator, VkDevice* device) {
+// portability_features: supported VK_KHR_portability_subset features, null if extension is not present
+bool create_logical_device(VkPhysicalDevice phys_device, QueueFamilies qf,
+						   const VkPhysicalDeviceFeatures& supported_features,
+						   const VkPhysicalDevicePortabilitySubsetFeaturesKHR* portability_features,
+						   VkAllocationCallbacks* pallocator, VkDevice* device) {
 
 	VkDeviceQueueCreateInfo qci[2] = {}; // graphics + present
 	uint32_t qf_indices[2] = { qf.graphics_, qf.present_ };
@@ -430,9 +453,19 @@ bool create_logical_device(VkPhysicalDevice phys_device, QueueFamilies qf, VkAll
 
 	// fill as necessary later
 	VkPhysicalDeviceFeatures features = {};
+	features.multiDrawIndirect = supported_features.multiDrawIndirect;
+	features.textureCompressionBC = supported_features.textureCompressionBC;
+
+	// everything not enabled here is unavailable on portability subset devices
+	VkPhysicalDevicePortabilitySubsetFeaturesKHR portability = {};
+	if (portability_features) {
+		portability = *portability_features;
+		portability.pNext = nullptr;
+	}
 
 	VkDeviceCreateInfo device_create_info = {};
 	device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	device_create_info.pNext = portability_features ? &portability : nullptr;
 	device_create_info.pQueueCreateInfos = &qci[0];
 	device_create_info.queueCreateInfoCount = qci_count;
 	device_create_info.pEnabledFeatures = &features;
@@ -651,13 +684,42 @@ bool vulkan_initialize(HWND rw_handle) {
 		return false;
 	}
 
-	if (!pick_phys_device(vk_dev.instance_, vk_dev.surface_, vk_dev.phys_device_, vk_dev.vk_phys_device_prop_)) {
+	if (!pick_phys_device(vk_dev.instance_, vk_dev.surface_, vk_dev.phys_device_,
+						  vk_dev.vk_phys_device_prop_, vk_dev.vk_phys_device_features_)) {
 		return false;
 	}
 
+	// portability subset implementations (e.g. MoltenVK) must have the extension enabled and may lack
+	// some features, triangle fans among them
+	VkPhysicalDevicePortabilitySubsetFeaturesKHR portability_features = {
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PORTABILITY_SUBSET_FEATURES_KHR,
+		nullptr,
+	};
+	const bool has_portability_subset =
+		is_device_extension_supported(vk_dev.phys_device_, VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
+	if (has_portability_subset) {
+		req_device_ext.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
+		VkPhysicalDeviceFeatures2 features = {
+			VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+			&portability_features,
+		};
+		vkGetPhysicalDeviceFeatures2(vk_dev.phys_device_, &features);
+	}
+
 	// fill device properties
 	vk_dev.phys_device_prop_.minUniformBufferOffsetAlignment =
 		vk_dev.vk_phys_device_prop_.limits.minUniformBufferOffsetAlignment;
+	vk_dev.phys_device_prop_.multiDrawIndirect =
+		VK_TRUE == vk_dev.vk_phys_device_features_.multiDrawIndirect;
+	vk_dev.phys_device_prop_.triangleFans =
+		!has_portability_subset || VK_TRUE == portability_features.triangleFans;
+	// also needs timestampValidBits of the graphics queue, checked once queue families are known
+	vk_dev.phys_device_prop_.timestampPeriod =
+		vk_dev.vk_phys_device_prop_.limits.timestampComputeAndGraphics
+			? vk_dev.vk_phys_device_prop_.limits.timestampPeriod
+			: 0.0f;
+	vk_dev.phys_device_prop_.textureCompressionBC =
+		VK_TRUE == vk_dev.vk_phys_device_features_.textureCompressionBC;
 
 #if USE_GLAD_LOADER
     int glad_vk_version = gladLoaderLoadVulkan(vk_dev.instance_, vk_dev.phys_device_, NULL);
@@ -673,7 +735,22 @@ bool vulkan_initialize(HWND rw_handle) {
 
 	vk_dev.queue_families_ = find_queue_families(vk_dev.phys_device_, vk_dev.surface_);
 
-	if (!create_logical_device(vk_dev.phys_device_, vk_dev.queue_families_, vk_dev.pallocator_, &vk_dev.device_)) {
+	// queues which report 0 valid bits write garbage timestamps
+	{
+		uint32_t count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_dev.phys_device_, &count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(count);
+		vkGetPhysicalDeviceQueueFamilyProperties(vk_dev.phys_device_, &count, families.data());
+		const uint32_t graphics = vk_dev.queue_families_.graphics_;
+		if (graphics >= count || 0 == families[graphics].timestampValidBits) {
+			vk_dev.phys_device_prop_.timestampPeriod = 0.0f;
+		}
+	}
+
+	if (!create_logical_device(vk_dev.phys_device_, vk_dev.queue_families_,
+							   vk_dev.vk_phys_device_features_,
+							   has_portability_subset ? &portability_features : nullptr,
+							   vk_dev.pallocator_, &vk_dev.device_)) {
 		return false;
 	}
 
@@ -98,24 +98,33 @@ struct BufferView {
 };
 
 static class TextureCache* g_texCache;
+// TEXF_P8 world textures kept as indices and palette rows, see options.palettedTextures
+static class TextureCache* g_texCachePaletted;
 
 struct SimpleVertex {
     vec4 pos;
     vec4 color;
     vec2 uv;
 };
+// UVs of complex surfaces are calculated in VS from per draw call data, so only position is needed
 struct UEVertexComplex {
 	vec3 Pos;
-	vec2 TexCoord;
-	//uint32_t Flags;
 };
 
 struct UEVertexGouraud {
 	vec3 Pos;
-	vec4 TexCoord;
+	vec2 TexCoord;
 	DWORD Color;
 	DWORD FogColor;
 };
+// editor lines and points
+struct UEVertexLine {
+	vec3 Pos;
+	DWORD Color;
+};
+
+static_assert(sizeof(UEVertexComplex) == 12, "UEVertexComplex should be tightly packed");
+static_assert(sizeof(UEVertexGouraud) == 28, "UEVertexGouraud should be tightly packed");
 
 struct PerFrameUniforms {
 	vec4 stuff;
@@ -142,6 +151,10 @@ struct UEPerDrawCallComplexVsData {
 	vec4 Detail_PanXY_UVMult;
 	vec4 HasDetail_UVScale;
 	mat4 proj;
+	// identity if vertices are already in view space, see StaticWorldCache
+	mat4 world_to_view;
+	// x - row of diffuse palette in palette image, -1 if diffuse is RGBA
+	vec4 Palette;
 };
 
 struct UEPerDrawCallGouraudVsData {
@@ -152,11 +165,38 @@ struct UEPerDrawCallGouraudVsData {
 struct UEPerFrameUniformBuf {
 	mat4 proj;
 	vec4 DetailColor;
+	// x: 1 / gUEDetailFadeDistance
+	vec4 DetailParams;
 };
 
 mat4 g_current_projection = mat4::identity();
 RHIViewport g_current_viewport;
 
+// All viewports used during the frame, draw calls reference them by index
+// (DX security cameras, split screen and editor views can set several viewports per frame)
+std::vector<RHIViewport> g_frame_viewports;
+uint16_t g_current_viewport_idx = 0;
+
+// makes viewport current, adding it to the frame's table if it is not there yet
+static void ue_set_current_viewport(const RHIViewport& viewport) {
+	g_current_viewport = viewport;
+	for (size_t i = 0; i < g_frame_viewports.size(); ++i) {
+		if (0 == memcmp(&g_frame_viewports[i], &viewport, sizeof(RHIViewport))) {
+			g_current_viewport_idx = (uint16_t)i;
+			return;
+		}
+	}
+	assert(g_frame_viewports.size() < 0xFFFF);
+	g_current_viewport_idx = (uint16_t)g_frame_viewports.size();
+	g_frame_viewports.push_back(viewport);
+}
+
+// called at the end of the frame, current viewport stays valid for the next frame
+static void ue_reset_frame_viewports() {
+	g_frame_viewports.resize(0);
+	ue_set_current_viewport(g_current_viewport);
+}
+
 RHIVertexInputBindingDesc vert_bindings_desc[] = {
 	{0, sizeof(SimpleVertex), RHIVertexInputRate::kVertex}};
 
@@ -169,6 +209,9 @@ RHIVertexInputBindingDesc ue_complex_vert_bindings_desc[] = {
 RHIVertexInputBindingDesc ue_gouraud_vert_bindings_desc[] = {
 	{0, sizeof(UEVertexGouraud), RHIVertexInputRate::kVertex}};
 
+RHIVertexInputBindingDesc ue_line_vert_bindings_desc[] = {
+	{0, sizeof(UEVertexLine), RHIVertexInputRate::kVertex}};
+
 RHIVertexInputAttributeDesc va_desc[] = {
 	{0, vert_bindings_desc[0].binding, RHIFormat::kR32G32B32A32_SFLOAT,
 	 offsetof(SimpleVertex, pos)},
@@ -187,20 +230,24 @@ RHIVertexInputAttributeDesc world_model_va_desc[] = {
 
 RHIVertexInputAttributeDesc ue_complex_va_desc[] = {
 	{0, ue_complex_vert_bindings_desc[0].binding, RHIFormat::kR32G32B32_SFLOAT,
-	 offsetof(UEVertexComplex, Pos)},
-	{1, ue_complex_vert_bindings_desc[0].binding, RHIFormat::kR32G32_SFLOAT,
-	 offsetof(UEVertexComplex, TexCoord)}};
+	 offsetof(UEVertexComplex, Pos)}};
 
 RHIVertexInputAttributeDesc ue_gouraud_va_desc[] = {
 	{0, ue_gouraud_vert_bindings_desc[0].binding, RHIFormat::kR32G32B32_SFLOAT,
 	 offsetof(UEVertexGouraud, Pos)},
-	{1, ue_gouraud_vert_bindings_desc[0].binding, RHIFormat::kR32G32B32A32_SFLOAT,
+	{1, ue_gouraud_vert_bindings_desc[0].binding, RHIFormat::kR32G32_SFLOAT,
 	 offsetof(UEVertexGouraud, TexCoord)},
 	{2, ue_gouraud_vert_bindings_desc[0].binding, RHIFormat::kB8G8R8A8_UNORM,
 	 offsetof(UEVertexGouraud, Color)},
 	{3, ue_gouraud_vert_bindings_desc[0].binding, RHIFormat::kB8G8R8A8_UNORM,
 	 offsetof(UEVertexGouraud, FogColor)}};
 
+RHIVertexInputAttributeDesc ue_line_va_desc[] = {
+	{0, ue_line_vert_bindings_desc[0].binding, RHIFormat::kR32G32B32_SFLOAT,
+	 offsetof(UEVertexLine, Pos)},
+	{1, ue_line_vert_bindings_desc[0].binding, RHIFormat::kB8G8R8A8_UNORM,
+	 offsetof(UEVertexLine, Color)}};
+
 // Create Test Vertex Buffer
 SimpleVertex vb[] = {{{-0.55f, -0.55f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
 					 {{-0.55f, 0.55f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 0.0f}, {0.0f, 1.0f}},
@@ -216,7 +263,7 @@ IRHIBuffer* g_quad_staging_vb = nullptr;
 IRHIEvent* g_quad_vb_copy_event= nullptr;
 
 struct SBuffer {
-	enum BufType_t { kUnknown = 0, kIB = 1, kVB = 2, kUni = 3 };
+	enum BufType_t { kUnknown = 0, kIB = 1, kVB = 2, kUni = 3, kIndirect = 4 };
 
 	IRHIBuffer* device_buf_ = nullptr;
 	IRHIBuffer* staging_buf_ = nullptr;
@@ -245,6 +292,12 @@ struct SBuffer {
 		return b;
 	}
 
+	static SBuffer* makeIndirect(IRHIDevice* dev, uint32_t size, const void* data) {
+		SBuffer* b = make(dev, size, RHIBufferUsageFlagBits::kIndirectBufferBit, data);
+		b->type_ = kIndirect;
+		return b;
+	}
+
 	static SBuffer* make(IRHIDevice* dev, uint32_t size, uint32_t usage, const void* data) {
 		SBuffer* buf = new SBuffer();
 		buf->size_ = size;
@@ -279,31 +332,55 @@ struct SBuffer {
 	void CopyToGPU(IRHIDevice* dev, IRHICmdBuf* cb) {
 		//if (!copy_event_->IsSet(dev)) {
 			cb->CopyBuffer(device_buf_, 0, staging_buf_, 0, staging_buf_->Size());
-			RHIAccessFlags dst_acc_flags;
-			RHIPipelineStageFlags::Value dst_pipe_stage;
-			switch (type_) {
-			case kIB: 
-				dst_acc_flags = RHIAccessFlagBits::kIndexRead;
-				dst_pipe_stage = RHIPipelineStageFlags::kVertexInput;
-				break;
-			case kVB: 
-				dst_acc_flags = RHIAccessFlagBits::kVertexAttributeRead;
-				dst_pipe_stage = RHIPipelineStageFlags::kVertexInput;
-				break;
-			case kUni: 
-				dst_acc_flags = RHIAccessFlagBits::kShaderRead;
-				// TODO: may pass exact flags in case of Uniform Buffer for now select earliest one
-				dst_pipe_stage = RHIPipelineStageFlags::kVertexShader;
-				break;
-			default:
-				assert(!"Wrong buffer type, TODO: add case for uniform buffer");
-			};
-			cb->BufferBarrier(device_buf_, (uint32_t)RHIAccessFlagBits::kTransferWrite,
-							  RHIPipelineStageFlags::kTransfer, dst_acc_flags, dst_pipe_stage);
-			cb->SetEvent(copy_event_, dst_pipe_stage);
+			BarrierAfterCopy(cb);
 		//}
 	}
 
+	// only copies specified ranges (offset, size in bytes) of staging buffer
+	void CopyRangesToGPU(IRHIDevice* dev, IRHICmdBuf* cb, const uint32_t* offsets,
+						 const uint32_t* sizes, int count) {
+		bool b_copied = false;
+		for (int i = 0; i < count; ++i) {
+			if (!sizes[i])
+				continue;
+			assert((uint64_t)offsets[i] + sizes[i] <= (uint64_t)size_);
+			cb->CopyBuffer(device_buf_, offsets[i], staging_buf_, offsets[i], sizes[i]);
+			b_copied = true;
+		}
+		if (b_copied) {
+			BarrierAfterCopy(cb);
+		}
+	}
+
+	void BarrierAfterCopy(IRHICmdBuf* cb) {
+		RHIAccessFlags dst_acc_flags;
+		RHIPipelineStageFlags::Value dst_pipe_stage;
+		switch (type_) {
+		case kIB: 
+			dst_acc_flags = RHIAccessFlagBits::kIndexRead;
+			dst_pipe_stage = RHIPipelineStageFlags::kVertexInput;
+			break;
+		case kVB: 
+			dst_acc_flags = RHIAccessFlagBits::kVertexAttributeRead;
+			dst_pipe_stage = RHIPipelineStageFlags::kVertexInput;
+			break;
+		case kUni: 
+			dst_acc_flags = RHIAccessFlagBits::kShaderRead;
+			// TODO: may pass exact flags in case of Uniform Buffer for now select earliest one
+			dst_pipe_stage = RHIPipelineStageFlags::kVertexShader;
+			break;
+		case kIndirect: 
+			dst_acc_flags = RHIAccessFlagBits::kIndirectCommandRead;
+			dst_pipe_stage = RHIPipelineStageFlags::kDrawIndirect;
+			break;
+		default:
+			assert(!"Wrong buffer type, TODO: add case for uniform buffer");
+		};
+		cb->BufferBarrier(device_buf_, (uint32_t)RHIAccessFlagBits::kTransferWrite,
+						  RHIPipelineStageFlags::kTransfer, dst_acc_flags, dst_pipe_stage);
+		cb->SetEvent(copy_event_, dst_pipe_stage);
+	}
+
 	bool IsReady(IRHIDevice* dev) const { return copy_event_->IsSet(dev); }
 
 	void Destroy(IRHIDevice* dev) {
@@ -316,6 +393,40 @@ struct SBuffer {
 struct SShader {
 
 	RHIShaderStage stages_[2];
+	uint32_t num_stages_ = 2;
+
+	// vertex shader only, e.g. for depth only pipelines
+	static SShader* load(IRHIDevice* dev, const char* vs) {
+		size_t vs_size;
+		const uint32_t* vs_data = (uint32_t*)filesystem::loadfile(vs, &vs_size);
+
+		SShader* sh = new SShader();
+
+		sh->stages_[0].module = dev->CreateShader(RHIShaderStageFlagBits::kVertex, vs_data, vs_size);
+		sh->stages_[0].pEntryPointName = "main";
+		sh->stages_[0].stage = RHIShaderStageFlagBits::kVertex;
+		sh->num_stages_ = 1;
+
+		delete[] vs_data;
+
+		return sh;
+	}
+
+	static SShader* loadCompute(IRHIDevice* dev, const char* cs) {
+		size_t cs_size;
+		const uint32_t* cs_data = (uint32_t*)filesystem::loadfile(cs, &cs_size);
+
+		SShader* sh = new SShader();
+
+		sh->stages_[0].module = dev->CreateShader(RHIShaderStageFlagBits::kCompute, cs_data, cs_size);
+		sh->stages_[0].pEntryPointName = "main";
+		sh->stages_[0].stage = RHIShaderStageFlagBits::kCompute;
+		sh->num_stages_ = 1;
+
+		delete[] cs_data;
+
+		return sh;
+	}
 
 	static SShader* load(IRHIDevice* dev, const char* vs, const char* fs) {
 		size_t vs_size;
@@ -344,7 +455,6 @@ std::vector<IRHIFrameBuffer*> g_main_fb;
 std::vector<IRHIImageView*> g_main_ds;
 
 IRHIGraphicsPipeline *g_tri_pipeline = nullptr;
-IRHIGraphicsPipeline *g_fs_clear_pipeline = nullptr;
 IRHIGraphicsPipeline *g_quad_pipeline = nullptr;
 IRHIGraphicsPipeline *g_world_model_pipeline = nullptr;
 
@@ -367,6 +477,7 @@ SBuffer* g_cube_vb = nullptr;
 SShader* g_cube_shader = nullptr;
 
 IRHISampler* g_test_sampler = nullptr;
+IRHISampler* g_point_sampler = nullptr;
 
 enum PipelineBlend : uint8_t {
 	kPipeBlendNo,
@@ -381,31 +492,50 @@ enum SurfaceShader : uint8_t {
 	kSurfaceShaderComplex,
 	kSurfaceShaderGouraud,
 	kSurfaceShaderClearDepth,
+	// Draw2DLine, line list
+	kSurfaceShaderLine,
+	// Draw2DPoint, two triangles per point
+	kSurfaceShaderPoint,
+	// complex surface with detail texturing compiled out
+	kSurfaceShaderComplexNoDetail,
+	// position only, depth pre-pass of opaque complex surfaces
+	kSurfaceShaderDepthOnly,
+	// alpha tested depth of masked surfaces, followed by colour with EQUAL depth test
+	kSurfaceShaderMaskedDepthComplex,
+	kSurfaceShaderMaskedDepthGouraud,
+	// diffuse and lightmap are sampled from SurfaceCache atlas as one texture
+	kSurfaceShaderComplexCached,
 };
 
 const uint32_t BLEND_MODE_MASK = 0x7;
 const uint32_t DEPTH_MODE_MASK = 0x1;
 const uint32_t ALPHA_TEST_MASK = 0x1;
-const uint32_t DEPTH_CLEAR_MASK = 0x1;
-const uint32_t SURFACE_SHADER_MASK = 0x3;
+const uint32_t DEPTH_EQUAL_MASK = 0x1;
+const uint32_t NO_DEPTH_TEST_MASK = 0x1;
+const uint32_t SURFACE_SHADER_MASK = 0xF;
 
 const uint32_t BLEND_MODE_OFFSET = 0;
 const uint32_t DEPTH_MODE_OFFSET = 3;
 const uint32_t ALPHA_TEST_OFFSET = 4;
-const uint32_t DEPTH_CLEAR_OFFSET = 5;
+const uint32_t DEPTH_EQUAL_OFFSET = 5;
+const uint32_t NO_DEPTH_TEST_OFFSET = 6;
 const uint32_t SURFACE_SHADER_OFFSET = 7;
 
-uint32_t make_key(SurfaceShader shader, PipelineBlend blend, bool depth_write, bool alpha_test) {
+// depth_equal: surface depth is already in depth buffer after depth pre-pass
+uint32_t make_key(SurfaceShader shader, PipelineBlend blend, bool depth_write, bool alpha_test,
+				  bool depth_test = true, bool depth_equal = false) {
 	uint32_t s = (uint32_t)shader;
 	uint32_t b = (uint32_t)blend;
 	uint32_t dw = !!depth_write;
 	uint32_t at = !!alpha_test;
-	//uint32_t clear = !!depth_clear;
+	uint32_t ndt = !depth_test;
+	uint32_t eq = !!depth_equal;
 
 	uint32_t rv = ((b & BLEND_MODE_MASK) << BLEND_MODE_OFFSET) |
 				  ((dw & DEPTH_MODE_MASK) << DEPTH_MODE_OFFSET) |
 				  ((at & ALPHA_TEST_MASK) << ALPHA_TEST_OFFSET) |
-				  //((clear & DEPTH_CLEAR_MASK) << DEPTH_CLEAR_OFFSET) |
+				  ((eq & DEPTH_EQUAL_MASK) << DEPTH_EQUAL_OFFSET) |
+				  ((ndt & NO_DEPTH_TEST_MASK) << NO_DEPTH_TEST_OFFSET) |
 				  ((s & SURFACE_SHADER_MASK) << SURFACE_SHADER_OFFSET);
 
 	return rv;
@@ -423,11 +553,18 @@ struct ComplexSurfaceDrawCall {
 	const IRHIImageView* macro;
 	const IRHIImageView* lightmap;
 	const IRHIImageView* detail;
+	// R8_UINT indices of paletted diffuse, diffuse is a placeholder then
+	const IRHIImageView* diffuse_index;
 	PipelineBlend pipeline_blend;
 	bool b_depth_write;
 	bool b_alpha_test;
+	// only lines and points can be drawn without depth test
+	bool b_depth_test;
 	SurfaceShader surface_shader;
-	RHIViewport viewport;
+	// vertices are in StaticWorldCache and not in per frame arena
+	bool b_static_geom;
+	// index in g_frame_viewports
+	uint16_t viewport_idx;
 };
 
 const uint32_t gUENumVert = 256 * 1024;
@@ -435,19 +572,497 @@ const uint32_t gUENumIndices = 256 * 1024;
 // expect no more than 1k draw calls per frame
 // TODO: we will come up with reallocation of course,.. later
 const uint32_t gUEDrawCalls = 1000;
-// Complex IB
-SBuffer* g_ue_complex_vb[kNumBufferedFrames] = { 0 };
-uint32_t g_ue_complex_vb_size[kNumBufferedFrames] = { 0 };
-// Complex VB
-SBuffer* g_ue_complex_ib[kNumBufferedFrames] = { 0 };
-uint32_t g_ue_complex_ib_size[kNumBufferedFrames] = { 0 };
-
-// Gouraud IB
-SBuffer* g_ue_gouraud_vb[kNumBufferedFrames] = { 0 };
-uint32_t g_ue_gouraud_vb_size[kNumBufferedFrames] = { 0 };
-// Gouraud VB
-SBuffer* g_ue_gouraud_ib[kNumBufferedFrames] = { 0 };
-uint32_t g_ue_gouraud_ib_size[kNumBufferedFrames] = { 0 };
+
+enum GeometryStreamType : uint8_t {
+	kGeomStreamComplex,
+	kGeomStreamGouraud,
+	kGeomStreamLine,
+	kGeomStreamCount
+};
+
+struct GeometryStream {
+	uint32_t vertex_size;
+	uint32_t max_vertices;
+	uint32_t max_indices;
+	// position of the stream in the arena: in vertices of this stream's type (so it can be passed
+	// as vertexOffset of a draw) and in indices
+	uint32_t base_vertex;
+	uint32_t base_index;
+	// used this frame
+	uint32_t vb_size[kNumBufferedFrames];
+	uint32_t ib_size[kNumBufferedFrames];
+};
+
+// Per frame geometry of all surface types: one VB and one IB with a sub-stream per surface type
+// at a fixed offset, so that switching between surface types does not need rebinding buffers
+struct GeometryArena {
+private:
+	~GeometryArena() {}
+public:
+	SBuffer* vb[kNumBufferedFrames] = {0};
+	SBuffer* ib[kNumBufferedFrames] = {0};
+	GeometryStream streams[kGeomStreamCount];
+
+	static GeometryArena* make(const uint32_t* vertex_sizes, uint32_t max_vertices,
+							   uint32_t max_indices, IRHIDevice* dev) {
+		GeometryArena* arena = new GeometryArena();
+		uint32_t vb_bytes = 0;
+		uint32_t ib_count = 0;
+		for (int i = 0; i < kGeomStreamCount; ++i) {
+			GeometryStream& gs = arena->streams[i];
+			gs.vertex_size = vertex_sizes[i];
+			gs.max_vertices = max_vertices;
+			gs.max_indices = max_indices;
+			// stream start has to be multiple of its vertex size
+			vb_bytes = ((vb_bytes + gs.vertex_size - 1) / gs.vertex_size) * gs.vertex_size;
+			gs.base_vertex = vb_bytes / gs.vertex_size;
+			gs.base_index = ib_count;
+			vb_bytes += gs.vertex_size * max_vertices;
+			ib_count += max_indices;
+			memset(gs.vb_size, 0, sizeof(gs.vb_size));
+			memset(gs.ib_size, 0, sizeof(gs.ib_size));
+		}
+
+		for (int i = 0; i < kNumBufferedFrames; ++i) {
+			arena->vb[i] = SBuffer::makeVB(dev, vb_bytes, nullptr);
+			arena->ib[i] = SBuffer::makeIB(dev, ib_count * sizeof(uint32_t), nullptr);
+		}
+		return arena;
+	}
+
+	template <typename V> V* vertices(GeometryStreamType type, int frame) const {
+		assert(sizeof(V) == streams[type].vertex_size);
+		return (V*)vb[frame]->getMappedPtr() + streams[type].base_vertex;
+	}
+
+	uint32_t* indices(GeometryStreamType type, int frame) const {
+		return (uint32_t*)ib[frame]->getMappedPtr() + streams[type].base_index;
+	}
+
+	bool empty(int frame) const {
+		for (int i = 0; i < kGeomStreamCount; ++i) {
+			// in kFanModeTable streams have vertices but no indices
+			if (streams[i].vb_size[frame] || streams[i].ib_size[frame])
+				return false;
+		}
+		return true;
+	}
+
+	// copies only filled parts of the streams
+	void CopyToGPU(int frame, IRHIDevice* dev, IRHICmdBuf* cb) {
+		uint32_t vb_offsets[kGeomStreamCount], vb_sizes[kGeomStreamCount];
+		uint32_t ib_offsets[kGeomStreamCount], ib_sizes[kGeomStreamCount];
+		for (int i = 0; i < kGeomStreamCount; ++i) {
+			const GeometryStream& gs = streams[i];
+			vb_offsets[i] = gs.base_vertex * gs.vertex_size;
+			vb_sizes[i] = gs.vb_size[frame] * gs.vertex_size;
+			ib_offsets[i] = gs.base_index * sizeof(uint32_t);
+			ib_sizes[i] = gs.ib_size[frame] * sizeof(uint32_t);
+		}
+		vb[frame]->CopyRangesToGPU(dev, cb, vb_offsets, vb_sizes, kGeomStreamCount);
+		ib[frame]->CopyRangesToGPU(dev, cb, ib_offsets, ib_sizes, kGeomStreamCount);
+	}
+
+	void reset(int frame) {
+		for (int i = 0; i < kGeomStreamCount; ++i) {
+			streams[i].vb_size[frame] = 0;
+			streams[i].ib_size[frame] = 0;
+		}
+	}
+};
+
+GeometryArena* g_ue_geom = nullptr;
+
+GeometryStreamType get_geom_stream(SurfaceShader shader) {
+	switch (shader) {
+	case kSurfaceShaderComplex:
+	case kSurfaceShaderComplexNoDetail:
+	case kSurfaceShaderComplexCached: return kGeomStreamComplex;
+	case kSurfaceShaderGouraud: return kGeomStreamGouraud;
+	case kSurfaceShaderLine:
+	case kSurfaceShaderPoint: return kGeomStreamLine;
+	default:
+		assert(!"Surface shader has no geometry stream");
+		return kGeomStreamCount;
+	}
+}
+
+const uint32_t gUEStaticWorldVerts = 1024 * 1024;
+// vertices are allocated from pages, least recently used page is evicted once all are in use
+const uint32_t gUEStaticWorldPageVerts = 16 * 1024;
+const uint32_t gUEStaticWorldPages = gUEStaticWorldVerts / gUEStaticWorldPageVerts;
+// longer polygons are always streamed
+const int32_t gUEMaxCachedPolyVerts = 64;
+// Transforming view space points back to world space is not bit exact, the error is a few ulps of
+// map coordinates (|x| <= 32768). Anything which moved further than this is treated as changed.
+const float gUEStaticWorldEpsilon = 1.0f / 32.0f;
+
+inline uint64_t ue_hash_u32(uint64_t h, uint32_t v) {
+	// FNV-1a
+	h ^= v;
+	h *= 1099511628211ull;
+	return h;
+}
+
+// Identifies polygon of a surface by its vertex count and first edge, positions are rounded to
+// integers so that round trip error does not change the key. All vertices are compared with the
+// cached ones (see StaticWorldCache::get()), so a collision can only cost a cache miss.
+static uint64_t ue_static_poly_key(uint64_t surface_key, const vec3* positions, int32_t count) {
+	uint64_t h = ue_hash_u32(surface_key, (uint32_t)count);
+	for (int32_t i = 0; i < 2; ++i) {
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].x + 0.5f));
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].y + 0.5f));
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].z + 0.5f));
+	}
+	return h;
+}
+
+// Hash of positions on a 1/32 grid, only tells whether a streamed polygon changed since the previous
+// frame, so an occasional flip at the grid boundary just delays caching by a frame
+static uint64_t ue_static_poly_content(const vec3* positions, uint32_t count) {
+	const float scale = 1.0f / gUEStaticWorldEpsilon;
+	uint64_t h = 14695981039346656037ull;
+	for (uint32_t i = 0; i < count; ++i) {
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].x * scale + 0.5f));
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].y * scale + 0.5f));
+		h = ue_hash_u32(h, (uint32_t)(int32_t)floorf(positions[i].z * scale + 0.5f));
+	}
+	return h;
+}
+
+// Geometry of one polygon in StaticWorldCache
+struct StaticPolyEntry {
+	uint32_t page;
+	uint32_t first_vertex;
+	uint32_t num_vertices;
+};
+
+struct StaticWorldPage {
+	uint32_t num_vertices;
+	// first vertex which was not copied to GPU yet
+	uint32_t upload_start;
+	uint32_t last_used_frame;
+	// polygons allocated in the page, removed from cache when page is evicted
+	std::vector<uint64_t> keys;
+};
+
+// Static world geometry (BSP) which stays in device local memory across frames.
+// Engine gives polygons already transformed to view space, so they are transformed back to world
+// space, looked up by surface and first edge (see ue_static_poly_key()) and compared with a CPU copy
+// of cached vertices. Movers and polygons clipped differently each frame do not match their entry and
+// are streamed, polygon is only added once it was seen unchanged in two frames in a row. When all
+// pages are full, the least recently used one which no frame in flight reads is evicted.
+struct StaticWorldCache {
+private:
+	~StaticWorldCache() {}
+public:
+	SBuffer* vb = nullptr;
+	// CPU copy of vb, vertices are compared with it
+	std::vector<vec3> positions;
+	StaticWorldPage pages[gUEStaticWorldPages];
+	// page new polygons are added to
+	uint32_t cur_page = 0;
+	std::unordered_map<uint64_t, StaticPolyEntry> polys;
+	// polygons streamed in the current and previous frame, key -> ue_static_poly_content()
+	std::unordered_map<uint64_t, uint64_t> seen[2];
+	uint32_t frame = 0;
+	// pages evicted since start
+	uint32_t num_evicted = 0;
+
+	static StaticWorldCache* make(IRHIDevice* dev) {
+		StaticWorldCache* cache = new StaticWorldCache();
+		cache->vb = SBuffer::makeVB(dev, gUEStaticWorldVerts * sizeof(UEVertexComplex), nullptr);
+		cache->positions.resize(gUEStaticWorldVerts);
+		for (uint32_t p = 0; p < gUEStaticWorldPages; ++p) {
+			cache->pages[p].num_vertices = 0;
+			cache->pages[p].upload_start = 0;
+			cache->pages[p].last_used_frame = 0;
+		}
+		return cache;
+	}
+
+	static bool same_positions(const vec3* a, const vec3* b, uint32_t count) {
+		for (uint32_t i = 0; i < count; ++i) {
+			if (fabsf(a[i].x - b[i].x) > gUEStaticWorldEpsilon ||
+				fabsf(a[i].y - b[i].y) > gUEStaticWorldEpsilon ||
+				fabsf(a[i].z - b[i].z) > gUEStaticWorldEpsilon)
+				return false;
+		}
+		return true;
+	}
+
+	// Returns cached polygon with these world space vertices or nullptr if it has to be streamed
+	const StaticPolyEntry* get(uint64_t surface_key, const vec3* world_pos, uint32_t count) {
+		const uint64_t key = ue_static_poly_key(surface_key, world_pos, count);
+		auto it = polys.find(key);
+		if (it != polys.end()) {
+			const StaticPolyEntry& entry = it->second;
+			if (entry.num_vertices == count &&
+				same_positions(&positions[entry.first_vertex], world_pos, count)) {
+				pages[entry.page].last_used_frame = frame;
+				return &entry;
+			}
+			// moved, vertices are left in the page until it is evicted
+			polys.erase(it);
+		}
+
+		// movers and polygons clipped differently each frame are never seen unchanged twice in a row
+		const uint64_t content = ue_static_poly_content(world_pos, count);
+		seen[frame & 1][key] = content;
+		auto prev = seen[(frame + 1) & 1].find(key);
+		if (prev == seen[(frame + 1) & 1].end() || prev->second != content)
+			return nullptr;
+
+		uint32_t first_vertex;
+		if (!alloc(count, &first_vertex))
+			return nullptr;
+		memcpy(&positions[first_vertex], world_pos, count * sizeof(vec3));
+		UEVertexComplex* VB = (UEVertexComplex*)vb->getMappedPtr() + first_vertex;
+		for (uint32_t i = 0; i < count; ++i) {
+			VB[i].Pos = world_pos[i];
+		}
+		pages[cur_page].keys.push_back(key);
+		StaticPolyEntry& entry = polys[key];
+		entry.page = cur_page;
+		entry.first_vertex = first_vertex;
+		entry.num_vertices = count;
+		return &entry;
+	}
+
+	bool alloc(uint32_t count, uint32_t* first_vertex) {
+		assert(count <= gUEStaticWorldPageVerts);
+		if (pages[cur_page].num_vertices + count > gUEStaticWorldPageVerts) {
+			// empty page or least recently used one which is not read by frames in flight
+			uint32_t lru = gUEStaticWorldPages;
+			for (uint32_t p = 0; p < gUEStaticWorldPages; ++p) {
+				if (p == cur_page)
+					continue;
+				if (0 == pages[p].num_vertices) {
+					lru = p;
+					break;
+				}
+				if (pages[p].last_used_frame + kNumBufferedFrames >= frame)
+					continue;
+				if (lru == gUEStaticWorldPages || pages[p].last_used_frame < pages[lru].last_used_frame)
+					lru = p;
+			}
+			if (lru == gUEStaticWorldPages)
+				return false;
+			evict(lru);
+			cur_page = lru;
+		}
+		StaticWorldPage& page = pages[cur_page];
+		*first_vertex = cur_page * gUEStaticWorldPageVerts + page.num_vertices;
+		page.num_vertices += count;
+		page.last_used_frame = frame;
+		return true;
+	}
+
+	void evict(uint32_t p) {
+		StaticWorldPage& page = pages[p];
+		if (page.num_vertices) {
+			num_evicted++;
+		}
+		for (size_t i = 0; i < page.keys.size(); ++i) {
+			auto it = polys.find(page.keys[i]);
+			if (it != polys.end() && it->second.page == p) {
+				polys.erase(it);
+			}
+		}
+		page.keys.clear();
+		page.num_vertices = 0;
+		page.upload_start = 0;
+	}
+
+	// copies vertices added this frame, ends the frame
+	void CopyToGPU(IRHIDevice* dev, IRHICmdBuf* cb) {
+		uint32_t offsets[gUEStaticWorldPages], sizes[gUEStaticWorldPages];
+		for (uint32_t p = 0; p < gUEStaticWorldPages; ++p) {
+			StaticWorldPage& page = pages[p];
+			const uint32_t first = p * gUEStaticWorldPageVerts + page.upload_start;
+			offsets[p] = first * sizeof(UEVertexComplex);
+			sizes[p] = (page.num_vertices - page.upload_start) * sizeof(UEVertexComplex);
+			page.upload_start = page.num_vertices;
+		}
+		vb->CopyRangesToGPU(dev, cb, offsets, sizes, gUEStaticWorldPages);
+
+		frame++;
+		seen[frame & 1].clear();
+	}
+};
+
+StaticWorldCache* g_ue_world_cache = nullptr;
+
+// timestamps of one frame: begin, end and begin/end pairs of depth pre-pass spans
+const uint32_t kGpuTimestampsPerFrame = 8;
+const uint32_t kGpuTsFrameBegin = 0;
+const uint32_t kGpuTsFrameEnd = 1;
+const uint32_t kGpuTsFirstSpan = 2;
+
+// GPU time of a frame and of depth pre-pass in it, measured with timestamp queries. Results are
+// read back when frame slot is reused, so they are kNumBufferedFrames late.
+struct GpuFrameTimer {
+private:
+	~GpuFrameTimer() {}
+public:
+	IRHIQueryPool* pool = nullptr;
+	float period_ns = 0.0f;
+	uint32_t num_spans[kNumBufferedFrames] = {0};
+	bool b_ended[kNumBufferedFrames] = {false};
+	// running averages in milliseconds
+	float frame_ms = 0.0f;
+	float prepass_ms = 0.0f;
+
+	static GpuFrameTimer* make(IRHIDevice* dev) {
+		const float period = dev->GetProperties().timestampPeriod;
+		if (0.0f == period) {
+			log_info("Timestamps are not supported, no GPU timing stats\n");
+			return nullptr;
+		}
+		IRHIQueryPool* pool = dev->CreateTimestampQueryPool(kNumBufferedFrames * kGpuTimestampsPerFrame);
+		if (!pool)
+			return nullptr;
+		GpuFrameTimer* timer = new GpuFrameTimer();
+		timer->pool = pool;
+		timer->period_ns = period;
+		return timer;
+	}
+
+	// should be called outside of render pass
+	void BeginFrame(IRHIDevice* dev, IRHICmdBuf* cb, int fb_idx) {
+		const uint32_t base = fb_idx * kGpuTimestampsPerFrame;
+		uint64_t ts[kGpuTimestampsPerFrame];
+		const uint32_t count = kGpuTsFirstSpan + 2 * num_spans[fb_idx];
+		if (b_ended[fb_idx] && pool->GetTimestamps(dev, base, count, ts)) {
+			const float to_ms = period_ns * 1e-6f;
+			float prepass = 0.0f;
+			for (uint32_t i = kGpuTsFirstSpan; i < count; i += 2) {
+				prepass += (float)(ts[i + 1] - ts[i]) * to_ms;
+			}
+			const float frame = (float)(ts[kGpuTsFrameEnd] - ts[kGpuTsFrameBegin]) * to_ms;
+			frame_ms += 0.1f * (frame - frame_ms);
+			prepass_ms += 0.1f * (prepass - prepass_ms);
+		}
+
+		cb->ResetQueryPool(pool, base, kGpuTimestampsPerFrame);
+		cb->WriteTimestamp(pool, RHIPipelineStageFlags::kTopOfPipe, base + kGpuTsFrameBegin);
+		num_spans[fb_idx] = 0;
+		b_ended[fb_idx] = false;
+	}
+
+	void EndFrame(IRHICmdBuf* cb, int fb_idx) {
+		const uint32_t base = fb_idx * kGpuTimestampsPerFrame;
+		cb->WriteTimestamp(pool, RHIPipelineStageFlags::kBottomOfPipe, base + kGpuTsFrameEnd);
+		b_ended[fb_idx] = true;
+	}
+
+	// returns false if frame has no free queries left, span is not measured in this case
+	bool BeginSpan(IRHICmdBuf* cb, int fb_idx) {
+		const uint32_t first = kGpuTsFirstSpan + 2 * num_spans[fb_idx];
+		if (first + 2 > kGpuTimestampsPerFrame)
+			return false;
+		cb->WriteTimestamp(pool, RHIPipelineStageFlags::kBottomOfPipe,
+						   fb_idx * kGpuTimestampsPerFrame + first);
+		return true;
+	}
+
+	void EndSpan(IRHICmdBuf* cb, int fb_idx) {
+		const uint32_t second = kGpuTsFirstSpan + 2 * num_spans[fb_idx] + 1;
+		cb->WriteTimestamp(pool, RHIPipelineStageFlags::kBottomOfPipe,
+						   fb_idx * kGpuTimestampsPerFrame + second);
+		num_spans[fb_idx]++;
+	}
+};
+
+GpuFrameTimer* g_gpu_timer = nullptr;
+// How polygon fans sent by the engine are turned into GPU primitives
+enum FanMode {
+	// CPU writes (N-2)*3 triangle list indices per fan
+	kFanModeCPUList,
+	// fan topology with primitive restart, N+1 sequential indices per fan
+	kFanModeNative,
+	// no indices written per frame: every fan is drawn with a precomputed 16 bit fan index table
+	// and its first vertex as vertexOffset (for devices without triangle fans)
+	kFanModeTable,
+	kFanModeCount
+};
+FanMode g_fan_mode = kFanModeCPUList;
+
+const uint32_t kFanRestartIndex = 0xFFFFFFFF;
+// longest fan which can be drawn in kFanModeTable
+const uint32_t gUEMaxFanVerts = 1024;
+SBuffer* g_ue_fan_table_ib = nullptr;
+bool g_ue_fan_table_uploaded = false;
+
+// fan of N vertices uses first (N-2)*3 indices of the table, so one table serves all fan sizes
+void ue_fill_fan_index_table(uint16_t* IB, uint32_t max_verts) {
+	for (uint32_t i = 1; i < max_verts - 1; i++) {
+		*IB++ = 0; // Center point
+		*IB++ = (uint16_t)i;
+		*IB++ = (uint16_t)(i + 1);
+	}
+}
+
+inline uint32_t ue_fan_index_count(FanMode mode, uint32_t num_verts) {
+	switch (mode) {
+	case kFanModeCPUList: return (num_verts - 2) * 3;
+	case kFanModeNative: return num_verts + 1;
+	default: return 0;
+	}
+}
+
+// Writes indices of a fan starting at first_vert to IB, returns number of written indices
+inline uint32_t ue_emit_fan_indices(FanMode mode, uint32_t* IB, uint32_t first_vert,
+									uint32_t num_verts) {
+	uint32_t* p = IB;
+	switch (mode) {
+	case kFanModeCPUList:
+		for (uint32_t i = 1; i < num_verts - 1; i++) {
+			*p++ = first_vert; // Center point
+			*p++ = first_vert + i;
+			*p++ = first_vert + i + 1;
+		}
+		break;
+	case kFanModeNative:
+		for (uint32_t i = 0; i < num_verts; i++) {
+			*p++ = first_vert + i;
+		}
+		*p++ = kFanRestartIndex;
+		break;
+	default:
+		break;
+	}
+	return (uint32_t)(p - IB);
+}
+
+// Number of indices to draw for a fan record (table mode always draws a single fan)
+inline uint32_t ue_fan_draw_index_count(FanMode mode, uint32_t num_verts, uint32_t num_written) {
+	return kFanModeTable == mode ? (num_verts - 2) * 3 : num_written;
+}
+
+// Table can not draw fans longer than gUEMaxFanVerts, so such fans are written as pieces of at most
+// gUEMaxFanVerts vertices, each one a fan which starts with the centre and repeats the last vertex
+// of the previous piece. Every piece is a separate record.
+inline bool ue_fan_needs_split(FanMode mode, uint32_t num_verts) {
+	return kFanModeTable == mode && num_verts > gUEMaxFanVerts;
+}
+
+// number of vertices written for a split fan
+inline uint32_t ue_split_fan_vertex_count(uint32_t num_verts) {
+	const uint32_t num_pieces = (num_verts - 2 + gUEMaxFanVerts - 3) / (gUEMaxFanVerts - 2);
+	return num_pieces * 2 + num_verts - 2;
+}
+
+// fan vertex which i-th written vertex of a split fan is
+inline uint32_t ue_split_fan_src_vertex(uint32_t i) {
+	const uint32_t r = i % gUEMaxFanVerts;
+	return r ? (i / gUEMaxFanVerts) * (gUEMaxFanVerts - 2) + r : 0;
+}
+
+// Indirect draw commands, one RHIDrawIndexedIndirectCommand per entry in g_draw_calls, draws which
+// do not fit are submitted directly
+const uint32_t gUEIndirectDraws = 8 * gUEDrawCalls;
+SBuffer* g_ue_indirect_buf[kNumBufferedFrames] = { 0 };
 
 // dynamic UB for VS per draw call data
 template<typename T>
@@ -526,8 +1141,15 @@ DynamicUB<UEPerDrawCallGouraudVsData>* g_ue_gouraud_vs_ub = nullptr;
 
 SShader* g_ue_complex_shader = nullptr;
 SShader* g_ue_complex_shader_alpha_test = nullptr;
+SShader* g_ue_complex_shader_no_detail = nullptr;
+SShader* g_ue_complex_shader_cached = nullptr;
+SShader* g_ue_surface_cache_build_shader = nullptr;
 SShader* g_ue_gouraud_shader = nullptr;
 SShader* g_ue_gouraud_shader_alpha_test = nullptr;
+SShader* g_ue_line_shader = nullptr;
+SShader* g_ue_depth_only_shader = nullptr;
+SShader* g_ue_complex_masked_depth_shader = nullptr;
+SShader* g_ue_gouraud_masked_depth_shader = nullptr;
 
 IRHIDescriptorSetLayout* g_ue_dsl_complex= 0;
 IRHIDescriptorSetLayout* g_ue_dsl_gouraud = 0;
@@ -550,6 +1172,67 @@ std::vector<TextureUploadTask*> g_tex_upload_tasks;
 std::vector<TextureUploadTask*> g_tex_upload_in_progress;
 //std::vector<TextureUploadTask> g_tex_upload_done;
 
+// Shown instead of textures which are still being converted by texture workers
+IRHIImageView* g_tex_placeholder_view = nullptr;
+// Bound as paletted diffuse of draws which do not have one
+IRHIImageView* g_tex_dummy_index_view = nullptr;
+// uploaded with the first frame
+TextureUploadTask* g_tex_placeholder_task = nullptr;
+TextureUploadTask* g_tex_dummy_index_task = nullptr;
+
+// Textures queued by PrecacheTexture since the last frame, their conversion is waited for and
+// they are uploaded all at once by the next Unlock
+struct UEPrecacheBatch {
+	int num_textures;
+	int num_skipped;
+	LARGE_INTEGER start;
+};
+UEPrecacheBatch g_precache_batch = { 0, 0 };
+
+static IRHIImageView* ue_create_1x1_texture(IRHIDevice* dev, RHIFormat format, uint32_t texel,
+											 int texel_size, TextureUploadTask** task) {
+	RHIImageDesc img_desc;
+	img_desc.type = RHIImageType::k2D;
+	img_desc.format = format;
+	img_desc.width = 1;
+	img_desc.height = 1;
+	img_desc.depth = 1;
+	img_desc.arraySize = 1;
+	img_desc.numMips = 1;
+	img_desc.numSamples = RHISampleCount::k1Bit;
+	img_desc.tiling = RHIImageTiling::kOptimal;
+	img_desc.usage = RHIImageUsageFlagBits::SampledBit | RHIImageUsageFlagBits::TransferDstBit;
+	img_desc.sharingMode = RHISharingMode::kExclusive;
+	IRHIImage* image = dev->CreateImage(&img_desc, RHIImageLayout::kUndefined,
+										RHIMemoryPropertyFlagBits::kDeviceLocal);
+	assert(image);
+
+	RHIImageViewDesc iv_desc;
+	iv_desc.image = image;
+	iv_desc.viewType = RHIImageViewType::k2d;
+	iv_desc.format = img_desc.format;
+	iv_desc.subresourceRange.aspectMask = RHIImageAspectFlags::kColor;
+	iv_desc.subresourceRange.baseArrayLayer = 0;
+	iv_desc.subresourceRange.baseMipLevel = 0;
+	iv_desc.subresourceRange.layerCount = 1;
+	iv_desc.subresourceRange.levelCount = 1;
+	IRHIImageView* view = dev->CreateImageView(&iv_desc);
+	assert(view);
+
+	const RHIBufferImageCopy region = { 0, 0, 1, 1 };
+	*task = TextureUploadTask::make(image, view, false, texel_size, &region, 1, dev);
+	memcpy((*task)->img_staging_buf->MappedPtr(), &texel, texel_size);
+	return view;
+}
+
+static void ue_create_texture_placeholder(IRHIDevice* dev) {
+	// opaque mid grey
+	g_tex_placeholder_view = ue_create_1x1_texture(dev, RHIFormat::kR8G8B8A8_UNORM, 0xff808080,
+												   sizeof(uint32_t), &g_tex_placeholder_task);
+	g_tex_dummy_index_view =
+		ue_create_1x1_texture(dev, RHIFormat::kR8_UINT, 0, 1, &g_tex_dummy_index_task);
+}
+
 void update_uniform_staging_buf(int idx, IRHIDevice* dev) {
 	assert(idx >= 0 && idx < kNumBufferedFrames);
 
@@ -576,6 +1259,14 @@ void update_uniform_staging_buf(int idx, IRHIDevice* dev) {
 	g_uniform_staging_buffer[idx]->Unmap(dev);
 }
 
+// DetailTexColor unless ColorizeDetailTextures is on, detail texture keeps albedo as is
+const DWORD gUENeutralDetailTexColor = 0x00808080;
+// Distance (view space Z) at which detail texture is fully faded out, complex-surface.frag gets it
+// through per frame uniforms. Past it shader outputs albedo * 2 * DetailTexColor which is (nearly)
+// albedo for the neutral grey DetailTexColor, so detail texture can be dropped entirely. Not so with
+// ColorizeDetailTextures, which tints everything up to infinity.
+const float gUEDetailFadeDistance = 380.0f;
+
 void ue_update_per_frame_uniforms(int idx, IRHIDevice* dev, DWORD DetailTexColor) {
 	assert(idx >= 0 && idx < kNumBufferedFrames);
 	g_ue_per_frame_uniforms_ptr[idx]->proj = g_current_projection;
@@ -587,6 +1278,7 @@ void ue_update_per_frame_uniforms(int idx, IRHIDevice* dev, DWORD DetailTexColor
 	det_color *= 1.0f/255.0f;
 	det_color = clamp(det_color, 0,1);
 	g_ue_per_frame_uniforms_ptr[idx]->DetailColor = det_color;
+	g_ue_per_frame_uniforms_ptr[idx]->DetailParams = vec4(1.0f / gUEDetailFadeDistance, 0, 0, 0);
 	g_ue_per_frame_uniforms[idx]->Flush(dev, 0, 0);
 }
 
@@ -681,6 +1373,792 @@ static const RHIColorBlendState * const g_blend_states[kPipeBlendCount] = {&no_b
 // Pipelines for different states
 std::unordered_map<uint32_t, IRHIGraphicsPipeline*> g_ue_pipelines;
 
+// Surface cache: lightmapped world surfaces can be drawn from atlas pages where diffuse texture is
+// already modulated by lightmap (like surface cache of the software renderer), so the main pass
+// samples one texture per pixel. Tile of a surface covers its lightmap at diffuse texture
+// resolution and is rendered on GPU before the main pass (see surface-cache-build.frag) when it is
+// new, its lightmap or diffuse changed or pan has moved. Tiles are only appended, once atlas is full
+// the least recently used page which no frame in flight samples is emptied. Pages have no mips, so
+// surfaces whose texels are smaller than a pixel are not cached (see DrawComplexSurface).
+const uint32_t gUESurfaceCachePageSize = 2048;
+const uint32_t gUESurfaceCachePages = 4;
+// bigger tiles are stored downscaled
+const uint32_t gUESurfaceCacheMaxTile = 256;
+// tiles which do not fit into this frame's builds are drawn the usual way
+const uint32_t gUESurfaceCacheMaxBuilds = 512;
+
+struct UEVertexSurfaceCache {
+	vec2 Pos; // NDC in the atlas page
+	vec2 LightmapTexCoord;
+	vec2 DiffuseTexCoord;
+};
+
+static_assert(sizeof(UEVertexSurfaceCache) == 24, "UEVertexSurfaceCache should be tightly packed");
+
+RHIVertexInputBindingDesc ue_surface_cache_vert_bindings_desc[] = {
+	{0, sizeof(UEVertexSurfaceCache), RHIVertexInputRate::kVertex}};
+
+RHIVertexInputAttributeDesc ue_surface_cache_va_desc[] = {
+	{0, ue_surface_cache_vert_bindings_desc[0].binding, RHIFormat::kR32G32_SFLOAT,
+	 offsetof(UEVertexSurfaceCache, Pos)},
+	{1, ue_surface_cache_vert_bindings_desc[0].binding, RHIFormat::kR32G32_SFLOAT,
+	 offsetof(UEVertexSurfaceCache, LightmapTexCoord)},
+	{2, ue_surface_cache_vert_bindings_desc[0].binding, RHIFormat::kR32G32_SFLOAT,
+	 offsetof(UEVertexSurfaceCache, DiffuseTexCoord)}};
+
+// Render pass and pipeline which draw tiles, created in Init() so that they can use its states
+IRHIRenderPass* g_ue_surface_cache_pass = nullptr;
+IRHIGraphicsPipeline* g_ue_surface_cache_pipeline = nullptr;
+
+// row of tiles of similar height in an atlas page
+struct SurfaceCacheShelf {
+	uint32_t y;
+	uint32_t height;
+	// first free texel
+	uint32_t x;
+};
+
+// finds space for w x h rectangle in a page packed with shelves
+static bool ue_shelf_alloc(std::vector<SurfaceCacheShelf>& shelves, uint32_t* shelves_end,
+						   uint32_t page_size, uint32_t w, uint32_t h, uint32_t* x, uint32_t* y) {
+	for (size_t i = 0; i < shelves.size(); ++i) {
+		SurfaceCacheShelf& s = shelves[i];
+		// do not waste more than a quarter of a shelf
+		if (h <= s.height && s.height - h <= s.height / 4 && s.x + w <= page_size) {
+			*x = s.x;
+			*y = s.y;
+			s.x += w;
+			return true;
+		}
+	}
+	if (*shelves_end + h <= page_size) {
+		SurfaceCacheShelf s = { *shelves_end, h, w };
+		shelves.push_back(s);
+		*shelves_end += h;
+		*x = 0;
+		*y = s.y;
+		return true;
+	}
+	return false;
+}
+
+// least recently used page which is not sampled by frames in flight, num_pages if there is none
+static uint32_t ue_lru_page(const uint32_t* last_used_frame, uint32_t num_pages, uint32_t frame) {
+	uint32_t lru = num_pages;
+	for (uint32_t p = 0; p < num_pages; ++p) {
+		if (last_used_frame[p] + kNumBufferedFrames >= frame)
+			continue;
+		if (lru == num_pages || last_used_frame[p] < last_used_frame[lru])
+			lru = p;
+	}
+	return lru;
+}
+
+// lightmap coordinates params (pan, mult) which map lightmap to the rectangle of an atlas page where
+// its texel (0, 0) is at origin and whole USize x VSize lightmap would span size texels
+static void ue_lightmap_atlas_params(const FTextureInfo& L, const vec2& origin, const vec2& size,
+									 uint32_t page_size, vec4* pan_mult) {
+	const vec2 lm_mult(1.0f / (L.UScale * L.USize), 1.0f / (L.VScale * L.VSize));
+	const float inv_page = 1.0f / page_size;
+	// atlas = origin + t * scale = (Coord - (Pan' - 0.5*UVScale)) * Mult'
+	const vec2 mult = lm_mult * size * inv_page;
+	const vec2 pan = vec2(L.Pan.X, L.Pan.Y) - (origin * inv_page) / mult;
+	*pan_mult = vec4(pan.x, pan.y, mult.x, mult.y);
+}
+
+struct SurfaceCacheTile {
+	uint32_t page;
+	// position and size without 1 texel border
+	uint32_t x, y, w, h;
+	vec2 diffuse_pan;
+	vec2 lightmap_pan;
+	// has to be rebuilt, e.g. rebuild did not fit into a frame
+	bool b_dirty;
+	// frame in which tile was last built, it is built at most once per frame
+	uint32_t build_frame;
+};
+
+struct SurfaceCacheBuild {
+	uint32_t page;
+	const IRHIImageView* diffuse;
+	const IRHIImageView* lightmap;
+};
+
+struct SurfaceCache {
+private:
+	~SurfaceCache() {}
+public:
+	IRHIImage* pages[gUESurfaceCachePages] = {0};
+	IRHIImageView* page_views[gUESurfaceCachePages] = {0};
+	IRHIFrameBuffer* page_fbs[gUESurfaceCachePages] = {0};
+	std::vector<SurfaceCacheShelf> shelves[gUESurfaceCachePages];
+	// y of the next shelf
+	uint32_t shelves_end[gUESurfaceCachePages] = {0};
+	// frame in which a tile of the page was last drawn and keys of its tiles, for eviction
+	uint32_t page_used_frame[gUESurfaceCachePages] = {0};
+	std::vector<uint64_t> page_keys[gUESurfaceCachePages];
+	uint32_t num_evicted = 0;
+	bool b_pages_initialized = false;
+
+	// tile quads of the frame, 6 vertices per build
+	SBuffer* vb[kNumBufferedFrames] = {0};
+	std::vector<IRHIDescriptorSet*> dsets[kNumBufferedFrames];
+	const IRHIDescriptorSetLayout* dsl = nullptr;
+	std::vector<SurfaceCacheBuild> builds;
+
+	std::unordered_map<uint64_t, SurfaceCacheTile> tiles;
+	uint32_t frame = 0;
+	// surfaces drawn from the cache this frame
+	uint32_t drawn = 0;
+	// stats of the last frame
+	uint32_t num_built = 0;
+	uint32_t num_drawn = 0;
+
+	static SurfaceCache* make(IRHIDevice* dev, const IRHIDescriptorSetLayout* dsl) {
+		SurfaceCache* cache = new SurfaceCache();
+		cache->dsl = dsl;
+
+		RHIImageDesc img_desc;
+		img_desc.type = RHIImageType::k2D;
+		img_desc.format = RHIFormat::kR8G8B8A8_UNORM;
+		img_desc.width = gUESurfaceCachePageSize;
+		img_desc.height = gUESurfaceCachePageSize;
+		img_desc.depth = 1;
+		img_desc.arraySize = 1;
+		img_desc.numMips = 1;
+		img_desc.numSamples = RHISampleCount::k1Bit;
+		img_desc.tiling = RHIImageTiling::kOptimal;
+		// transfer dst is only needed for the initial layout transition
+		img_desc.usage = RHIImageUsageFlagBits::ColorAttachmentBit | RHIImageUsageFlagBits::SampledBit |
+						 RHIImageUsageFlagBits::TransferDstBit;
+		img_desc.sharingMode = RHISharingMode::kExclusive;
+
+		for (uint32_t p = 0; p < gUESurfaceCachePages; ++p) {
+			cache->pages[p] = dev->CreateImage(&img_desc, RHIImageLayout::kUndefined,
+											   RHIMemoryPropertyFlagBits::kDeviceLocal);
+			assert(cache->pages[p]);
+
+			RHIImageViewDesc iv_desc;
+			iv_desc.image = cache->pages[p];
+			iv_desc.viewType = RHIImageViewType::k2d;
+			iv_desc.format = img_desc.format;
+			iv_desc.subresourceRange.aspectMask = RHIImageAspectFlags::kColor;
+			iv_desc.subresourceRange.baseArrayLayer = 0;
+			iv_desc.subresourceRange.baseMipLevel = 0;
+			iv_desc.subresourceRange.layerCount = 1;
+			iv_desc.subresourceRange.levelCount = 1;
+			cache->page_views[p] = dev->CreateImageView(&iv_desc);
+			assert(cache->page_views[p]);
+
+			IRHIImageView* att_arr[] = { cache->page_views[p] };
+			RHIFrameBufferDesc fb_desc;
+			fb_desc.attachmentCount = countof(att_arr);
+			fb_desc.pAttachments = att_arr;
+			fb_desc.width_ = gUESurfaceCachePageSize;
+			fb_desc.height_ = gUESurfaceCachePageSize;
+			fb_desc.layers_ = 1;
+			cache->page_fbs[p] = dev->CreateFrameBuffer(&fb_desc, g_ue_surface_cache_pass);
+		}
+
+		for (int i = 0; i < kNumBufferedFrames; ++i) {
+			cache->vb[i] = SBuffer::makeVB(
+				dev, gUESurfaceCacheMaxBuilds * 6 * sizeof(UEVertexSurfaceCache), nullptr);
+		}
+		return cache;
+	}
+
+	// finds space for w x h rectangle in one of the pages, evicting a page if all are full
+	bool alloc(uint32_t w, uint32_t h, uint32_t* page, uint32_t* x, uint32_t* y) {
+		for (uint32_t p = 0; p < gUESurfaceCachePages; ++p) {
+			if (ue_shelf_alloc(shelves[p], &shelves_end[p], gUESurfaceCachePageSize, w, h, x, y)) {
+				*page = p;
+				return true;
+			}
+		}
+		const uint32_t p = ue_lru_page(page_used_frame, gUESurfaceCachePages, frame);
+		if (p == gUESurfaceCachePages)
+			return false;
+		evict(p);
+		*page = p;
+		return ue_shelf_alloc(shelves[p], &shelves_end[p], gUESurfaceCachePageSize, w, h, x, y);
+	}
+
+	void evict(uint32_t p) {
+		for (size_t i = 0; i < page_keys[p].size(); ++i) {
+			tiles.erase(page_keys[p][i]);
+		}
+		page_keys[p].clear();
+		shelves[p].clear();
+		shelves_end[p] = 0;
+		num_evicted++;
+	}
+
+	// Returns tile of the surface, queuing its build if needed, or nullptr if surface has to be
+	// drawn the usual way this frame. lightmap_xform (origin.xy, scale.zw) maps lightmap coordinates
+	// to the lightmap view, it is not identity when lightmap is in LightmapAtlas.
+	const SurfaceCacheTile* get(const FSurfaceInfo& Surface, const IRHIImageView* diffuse,
+								const IRHIImageView* lightmap, const vec4& lightmap_xform, int fb_idx) {
+		const FTextureInfo* D = Surface.Texture;
+		const FTextureInfo* L = Surface.LightMap;
+		const uint64_t key = ue_hash_u32(ue_hash_u32(ue_hash_u32(ue_hash_u32(14695981039346656037ull,
+			(uint32_t)D->CacheID), (uint32_t)(D->CacheID >> 32)), (uint32_t)L->CacheID),
+			(uint32_t)(L->CacheID >> 32));
+		const vec2 diffuse_pan(D->Pan.X, D->Pan.Y);
+		const vec2 lightmap_pan(L->Pan.X, L->Pan.Y);
+
+		SurfaceCacheTile* tile = nullptr;
+		auto it = tiles.find(key);
+		if (it != tiles.end()) {
+			tile = &it->second;
+			const bool b_changed = tile->b_dirty || tile->diffuse_pan != diffuse_pan ||
+								   tile->lightmap_pan != lightmap_pan || D->bRealtimeChanged ||
+								   L->bRealtimeChanged;
+			if (!b_changed || tile->build_frame == frame) {
+				page_used_frame[tile->page] = frame;
+				drawn++;
+				return tile;
+			}
+			if (builds.size() == gUESurfaceCacheMaxBuilds) {
+				tile->b_dirty = true;
+				return nullptr;
+			}
+		} else {
+			if (builds.size() == gUESurfaceCacheMaxBuilds)
+				return nullptr;
+			// lightmap covers the surface, tile has the number of diffuse texels it spans
+			const uint32_t tile_w = (uint32_t)ceilf(L->UScale * L->USize / D->UScale);
+			const uint32_t tile_h = (uint32_t)ceilf(L->VScale * L->VSize / D->VScale);
+			const uint32_t w = max(min(tile_w, gUESurfaceCacheMaxTile), 1u);
+			const uint32_t h = max(min(tile_h, gUESurfaceCacheMaxTile), 1u);
+			uint32_t page, x, y;
+			if (!alloc(w + 2, h + 2, &page, &x, &y))
+				return nullptr;
+			page_keys[page].push_back(key);
+			tile = &tiles[key];
+			tile->page = page;
+			tile->x = x + 1;
+			tile->y = y + 1;
+			tile->w = w;
+			tile->h = h;
+		}
+
+		tile->diffuse_pan = diffuse_pan;
+		tile->lightmap_pan = lightmap_pan;
+		tile->b_dirty = false;
+		tile->build_frame = frame;
+		page_used_frame[tile->page] = frame;
+
+		// diffuse coordinates at lightmap coordinates t are a + t * b, see complex-surface.vert
+		const vec2 lm_mult(1.0f / (L->UScale * L->USize), 1.0f / (L->VScale * L->VSize));
+		const vec2 d_mult(1.0f / (D->UScale * D->USize), 1.0f / (D->VScale * D->VSize));
+		const vec2 lm_origin = lightmap_pan - 0.5f * vec2(L->UScale, L->VScale);
+		const vec2 a = (lm_origin - diffuse_pan) * d_mult;
+		const vec2 b = d_mult / lm_mult;
+
+		// quad includes the border, so that bilinear filtering at tile edges reads continued surface
+		const float inv_page = 1.0f / gUESurfaceCachePageSize;
+		const vec2 p0 = vec2((float)(tile->x - 1), (float)(tile->y - 1)) * (2.0f * inv_page) - 1.0f;
+		const vec2 p1 = vec2((float)(tile->x + tile->w + 1), (float)(tile->y + tile->h + 1)) *
+							(2.0f * inv_page) - 1.0f;
+		const vec2 t0(-1.0f / tile->w, -1.0f / tile->h);
+		const vec2 t1(1.0f + 1.0f / tile->w, 1.0f + 1.0f / tile->h);
+		const float corners[6][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1} };
+
+		UEVertexSurfaceCache* VB =
+			(UEVertexSurfaceCache*)vb[fb_idx]->getMappedPtr() + builds.size() * 6;
+		for (int i = 0; i < 6; ++i) {
+			const float cu = corners[i][0], cv = corners[i][1];
+			const vec2 t(cu ? t1.x : t0.x, cv ? t1.y : t0.y);
+			VB[i].Pos = vec2(cu ? p1.x : p0.x, cv ? p1.y : p0.y);
+			VB[i].LightmapTexCoord = vec2(lightmap_xform.x, lightmap_xform.y) +
+									 t * vec2(lightmap_xform.z, lightmap_xform.w);
+			VB[i].DiffuseTexCoord = a + t * b;
+		}
+
+		SurfaceCacheBuild build = { tile->page, diffuse, lightmap };
+		builds.push_back(build);
+		drawn++;
+		return tile;
+	}
+
+	// lightmap coordinates params (pan, mult) which map lightmap of the surface to its tile
+	void get_lightmap_params(const SurfaceCacheTile& tile, const FTextureInfo& L, vec4* pan_mult) const {
+		ue_lightmap_atlas_params(L, vec2((float)tile.x, (float)tile.y),
+								 vec2((float)tile.w, (float)tile.h), gUESurfaceCachePageSize, pan_mult);
+	}
+
+	// records tiles queued this frame, should be called outside of render pass after texture uploads
+	void RecordBuilds(IRHIDevice* dev, IRHICmdBuf* cb, int fb_idx) {
+		num_built = (uint32_t)builds.size();
+		num_drawn = drawn;
+		drawn = 0;
+		frame++;
+		if (builds.empty())
+			return;
+
+		if (!b_pages_initialized) {
+			for (uint32_t p = 0; p < gUESurfaceCachePages; ++p) {
+				cb->Barrier_UndefinedToTransfer(pages[p]);
+				cb->Barrier_TransferToShaderRead(pages[p]);
+			}
+			b_pages_initialized = true;
+		}
+
+		const uint32_t offset = 0;
+		const uint32_t size = (uint32_t)builds.size() * 6 * sizeof(UEVertexSurfaceCache);
+		vb[fb_idx]->CopyRangesToGPU(dev, cb, &offset, &size, 1);
+
+		while (dsets[fb_idx].size() < builds.size()) {
+			dsets[fb_idx].push_back(dev->AllocateDescriptorSet(dsl));
+		}
+
+		RHIViewport viewport;
+		viewport.x = viewport.y = 0;
+		viewport.width = viewport.height = (float)gUESurfaceCachePageSize;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		const ivec4 render_area(0, 0, gUESurfaceCachePageSize, gUESurfaceCachePageSize);
+
+		for (uint32_t p = 0; p < gUESurfaceCachePages; ++p) {
+			bool b_in_pass = false;
+			for (size_t i = 0; i < builds.size(); ++i) {
+				const SurfaceCacheBuild& build = builds[i];
+				if (build.page != p)
+					continue;
+				if (!b_in_pass) {
+					// tiles are loaded, no clear values
+					cb->BeginRenderPass(g_ue_surface_cache_pass, page_fbs[p], &render_area, nullptr, 0);
+					cb->BindPipeline(RHIPipelineBindPoint::kGraphics, g_ue_surface_cache_pipeline);
+					cb->SetViewport(&viewport, 1);
+					cb->BindVertexBuffers(&vb[fb_idx]->device_buf_, 0, 1);
+					b_in_pass = true;
+				}
+
+				IRHIDescriptorSet* dset = dsets[fb_idx][i];
+				RHIDescriptorWriteDesc desc_write_desc[2];
+				RHIDescriptorWriteDescBuilder builder(desc_write_desc, countof(desc_write_desc));
+				builder.add(dset, 0, g_test_sampler, RHIImageLayout::kShaderReadOnlyOptimal, build.diffuse)
+					.add(dset, 1, g_test_sampler, RHIImageLayout::kShaderReadOnlyOptimal, build.lightmap);
+				dev->UpdateDescriptorSet(desc_write_desc, builder.cur_index);
+
+				const IRHIDescriptorSet* sets[] = { dset };
+				cb->BindDescriptorSets(RHIPipelineBindPoint::kGraphics,
+									   g_ue_surface_cache_pipeline->Layout(), sets, countof(sets), 0,
+									   nullptr);
+				cb->Draw(6, 1, (uint32_t)i * 6, 0);
+			}
+			if (b_in_pass) {
+				cb->EndRenderPass(g_ue_surface_cache_pass, page_fbs[p]);
+			}
+		}
+		builds.clear();
+	}
+};
+
+SurfaceCache* g_ue_surface_cache = nullptr;
+
+// Lightmap atlas: static lightmaps are packed into a few big pages instead of being a texture each,
+// so consecutive surfaces mostly share the lightmap binding and new lightmaps of a frame are uploaded
+// with one copy per page. Only the valid UClamp x VClamp part of a lightmap is stored, surrounded by
+// 1 texel border which repeats its edge texels, so bilinear filtering never reads the neighbours or
+// the garbage padding beyond u/vclamp (see Doc/notes.txt). Tiles are only appended, once atlas is full
+// the least recently used page which no frame in flight samples is emptied, same as in SurfaceCache.
+const uint32_t gUELightmapAtlasPageSize = 1024;
+const uint32_t gUELightmapAtlasPages = 4;
+// bigger lightmaps stay separate textures
+const uint32_t gUELightmapAtlasMaxTile = 256;
+// lightmaps which do not fit into this frame's staging are drawn the usual way
+const uint32_t gUELightmapAtlasStagingSize = 2 * 1024 * 1024;
+
+struct LightmapAtlasTile {
+	uint32_t page;
+	// position of lightmap texel (0, 0) and its valid size, without 1 texel border
+	uint32_t x, y, w, h;
+	// has to be uploaded: new, changed while dynamic or upload did not fit into a frame
+	bool b_dirty;
+};
+
+struct LightmapAtlas {
+private:
+	~LightmapAtlas() {}
+public:
+	IRHIImage* pages[gUELightmapAtlasPages] = {0};
+	IRHIImageView* page_views[gUELightmapAtlasPages] = {0};
+	std::vector<SurfaceCacheShelf> shelves[gUELightmapAtlasPages];
+	// y of the next shelf
+	uint32_t shelves_end[gUELightmapAtlasPages] = {0};
+	// frame in which a tile of the page was last used and keys of its tiles, for eviction
+	uint32_t page_used_frame[gUELightmapAtlasPages] = {0};
+	std::vector<uint64_t> page_keys[gUELightmapAtlasPages];
+	bool b_page_initialized[gUELightmapAtlasPages] = {0};
+
+	// bordered tiles of the frame, copied to pages at once
+	IRHIBuffer* staging[kNumBufferedFrames] = {0};
+	uint32_t staging_used = 0;
+	std::vector<RHIBufferImageCopy> uploads[gUELightmapAtlasPages];
+
+	std::unordered_map<uint64_t, LightmapAtlasTile> tiles;
+	uint32_t frame = 0;
+	// stats of the last frame
+	uint32_t num_uploaded = 0;
+	uint32_t num_evicted = 0;
+
+	static LightmapAtlas* make(IRHIDevice* dev) {
+		LightmapAtlas* atlas = new LightmapAtlas();
+
+		RHIImageDesc img_desc;
+		img_desc.type = RHIImageType::k2D;
+		// same as TEXF_RGBA7 in texture cache, shader swizzles it
+		img_desc.format = RHIFormat::kR8G8B8A8_UNORM;
+		img_desc.width = gUELightmapAtlasPageSize;
+		img_desc.height = gUELightmapAtlasPageSize;
+		img_desc.depth = 1;
+		img_desc.arraySize = 1;
+		img_desc.numMips = 1;
+		img_desc.numSamples = RHISampleCount::k1Bit;
+		img_desc.tiling = RHIImageTiling::kOptimal;
+		img_desc.usage = RHIImageUsageFlagBits::SampledBit | RHIImageUsageFlagBits::TransferDstBit;
+		img_desc.sharingMode = RHISharingMode::kExclusive;
+
+		for (uint32_t p = 0; p < gUELightmapAtlasPages; ++p) {
+			atlas->pages[p] = dev->CreateImage(&img_desc, RHIImageLayout::kUndefined,
+											   RHIMemoryPropertyFlagBits::kDeviceLocal);
+			assert(atlas->pages[p]);
+
+			RHIImageViewDesc iv_desc;
+			iv_desc.image = atlas->pages[p];
+			iv_desc.viewType = RHIImageViewType::k2d;
+			iv_desc.format = img_desc.format;
+			iv_desc.subresourceRange.aspectMask = RHIImageAspectFlags::kColor;
+			iv_desc.subresourceRange.baseArrayLayer = 0;
+			iv_desc.subresourceRange.baseMipLevel = 0;
+			iv_desc.subresourceRange.layerCount = 1;
+			iv_desc.subresourceRange.levelCount = 1;
+			atlas->page_views[p] = dev->CreateImageView(&iv_desc);
+			assert(atlas->page_views[p]);
+		}
+
+		for (int i = 0; i < kNumBufferedFrames; ++i) {
+			atlas->staging[i] = dev->CreateBuffer(gUELightmapAtlasStagingSize,
+												  RHIBufferUsageFlagBits::kTransferSrcBit,
+												  RHIMemoryPropertyFlagBits::kHostVisible,
+												  RHISharingMode::kExclusive);
+			assert(atlas->staging[i]);
+			atlas->staging[i]->Map(dev, 0, gUELightmapAtlasStagingSize, 0);
+		}
+		return atlas;
+	}
+
+	bool alloc(uint32_t w, uint32_t h, uint32_t* page, uint32_t* x, uint32_t* y) {
+		for (uint32_t p = 0; p < gUELightmapAtlasPages; ++p) {
+			if (ue_shelf_alloc(shelves[p], &shelves_end[p], gUELightmapAtlasPageSize, w, h, x, y)) {
+				*page = p;
+				return true;
+			}
+		}
+		const uint32_t p = ue_lru_page(page_used_frame, gUELightmapAtlasPages, frame);
+		if (p == gUELightmapAtlasPages)
+			return false;
+		evict(p);
+		num_evicted++;
+		*page = p;
+		return ue_shelf_alloc(shelves[p], &shelves_end[p], gUELightmapAtlasPageSize, w, h, x, y);
+	}
+
+	void evict(uint32_t p) {
+		for (size_t i = 0; i < page_keys[p].size(); ++i) {
+			tiles.erase(page_keys[p][i]);
+		}
+		page_keys[p].clear();
+		shelves[p].clear();
+		shelves_end[p] = 0;
+	}
+
+	// Returns tile of the lightmap, queuing its upload if needed, or nullptr if lightmap has to be
+	// used as a separate texture this frame
+	const LightmapAtlasTile* get(const FTextureInfo& L, int fb_idx) {
+		if (L.Format != TEXF_RGBA7 || !L.Mips[0] || !L.Mips[0]->DataPtr)
+			return nullptr;
+
+		auto it = tiles.find(L.CacheID);
+		// Dynamic lightmaps stay separate textures with a ring of images (see CachedTexture), their
+		// uploads into a page would wait for frames in flight which sample it
+		if (L.bRealtime || L.bRealtimeChanged) {
+			if (it != tiles.end())
+				it->second.b_dirty = true;
+			return nullptr;
+		}
+
+		LightmapAtlasTile* tile = nullptr;
+		if (it != tiles.end()) {
+			tile = &it->second;
+			// dirty tile has never been uploaded or holds stale texels
+			if (!tile->b_dirty) {
+				page_used_frame[tile->page] = frame;
+				return tile;
+			}
+		} else {
+			const uint32_t w = min((uint32_t)L.UClamp, (uint32_t)L.Mips[0]->USize);
+			const uint32_t h = min((uint32_t)L.VClamp, (uint32_t)L.Mips[0]->VSize);
+			if (!w || !h || w + 2 > gUELightmapAtlasMaxTile || h + 2 > gUELightmapAtlasMaxTile)
+				return nullptr;
+			uint32_t page, x, y;
+			if (!alloc(w + 2, h + 2, &page, &x, &y))
+				return nullptr;
+			page_keys[page].push_back(L.CacheID);
+			tile = &tiles[L.CacheID];
+			tile->page = page;
+			tile->x = x + 1;
+			tile->y = y + 1;
+			tile->w = w;
+			tile->h = h;
+			tile->b_dirty = true;
+		}
+
+		const uint32_t bw = tile->w + 2;
+		const uint32_t bh = tile->h + 2;
+		const uint32_t size = bw * bh * 4;
+		if (staging_used + size > gUELightmapAtlasStagingSize) {
+			tile->b_dirty = true;
+			return nullptr;
+		}
+
+		// rows outside of the lightmap repeat its first and last rows, same for columns
+		const uint32_t* src = (const uint32_t*)L.Mips[0]->DataPtr;
+		const uint32_t src_pitch = L.Mips[0]->USize;
+		uint32_t* dst = (uint32_t*)((BYTE*)staging[fb_idx]->MappedPtr() + staging_used);
+		for (uint32_t row = 0; row < bh; ++row) {
+			const uint32_t src_row = (uint32_t)max(min((int)row - 1, (int)tile->h - 1), 0);
+			const uint32_t* s = src + src_row * src_pitch;
+			uint32_t* d = dst + row * bw;
+			d[0] = s[0];
+			memcpy(d + 1, s, tile->w * 4);
+			d[bw - 1] = s[tile->w - 1];
+		}
+
+		RHIBufferImageCopy region;
+		region.bufferOffset = staging_used;
+		region.mipLevel = 0;
+		region.width = bw;
+		region.height = bh;
+		region.x = (int32_t)tile->x - 1;
+		region.y = (int32_t)tile->y - 1;
+		uploads[tile->page].push_back(region);
+		staging_used += size;
+
+		tile->b_dirty = false;
+		page_used_frame[tile->page] = frame;
+		return tile;
+	}
+
+	// lightmap coordinates params (pan, mult) which map lightmap to its tile
+	void get_lightmap_params(const LightmapAtlasTile& tile, const FTextureInfo& L, vec4* pan_mult) const {
+		// tile only holds valid texels, but coordinates are still relative to whole USize x VSize
+		ue_lightmap_atlas_params(L, vec2((float)tile.x, (float)tile.y),
+								 vec2((float)L.USize, (float)L.VSize), gUELightmapAtlasPageSize, pan_mult);
+	}
+
+	// (origin.xy, scale.zw) which maps [0,1] lightmap texture coordinates to the page
+	vec4 get_xform(const LightmapAtlasTile& tile, const FTextureInfo& L) const {
+		const float inv_page = 1.0f / gUELightmapAtlasPageSize;
+		return vec4(tile.x * inv_page, tile.y * inv_page, L.USize * inv_page, L.VSize * inv_page);
+	}
+
+	// records uploads queued this frame, should be called outside of render pass before anything
+	// samples the pages
+	void RecordUploads(IRHICmdBuf* cb, int fb_idx) {
+		num_uploaded = 0;
+		for (uint32_t p = 0; p < gUELightmapAtlasPages; ++p) {
+			if (uploads[p].empty())
+				continue;
+			if (b_page_initialized[p]) {
+				cb->Barrier_ShaderReadToTransfer(pages[p]);
+			} else {
+				cb->Barrier_UndefinedToTransfer(pages[p]);
+				b_page_initialized[p] = true;
+			}
+			cb->CopyBufferToImage2D(pages[p], staging[fb_idx], uploads[p].data(),
+									(uint32_t)uploads[p].size());
+			cb->Barrier_TransferToShaderRead(pages[p]);
+			num_uploaded += (uint32_t)uploads[p].size();
+			uploads[p].clear();
+		}
+		staging_used = 0;
+		frame++;
+	}
+
+	// Drops all tiles, should be called between frames. Pages which previous frames may still sample
+	// keep their space taken until they are evicted.
+	void clear() {
+		log_info("Clearing lightmap atlas (%d tiles)\n", (int)tiles.size());
+		for (uint32_t p = 0; p < gUELightmapAtlasPages; ++p) {
+			if (page_used_frame[p] + kNumBufferedFrames < frame) {
+				evict(p);
+			} else {
+				for (size_t i = 0; i < page_keys[p].size(); ++i) {
+					tiles.erase(page_keys[p][i]);
+				}
+				page_keys[p].clear();
+			}
+			uploads[p].clear();
+		}
+		staging_used = 0;
+	}
+};
+
+LightmapAtlas* g_ue_lightmap_atlas = nullptr;
+
+// Paletted textures are expanded by expand-palette.comp (see TextureUploadTask::expanded_size) into
+// an arena and their mips are copied to the image from there, so only indices go through staging
+// memory. Arena is reused by every batch of expansions: batch waits for copies of the previous one
+// (or of the previous frame) with a barrier.
+const uint32_t gUETexExpandArenaSize = 16 * 1024 * 1024;
+// max of minStorageBufferOffsetAlignment allowed by spec
+const uint32_t gUETexExpandAlignment = 256;
+const uint32_t gUETexExpandGroupSize = 64;
+
+struct TextureExpander {
+private:
+	~TextureExpander() {}
+public:
+	SShader* shader = nullptr;
+	IRHIDescriptorSetLayout* dsl = nullptr;
+	IRHIPipelineLayout* pipeline_layout = nullptr;
+	IRHIComputePipeline* pipeline = nullptr;
+	IRHIBuffer* arena = nullptr;
+	std::vector<IRHIDescriptorSet*> dsets[kNumBufferedFrames];
+	uint32_t dsets_used[kNumBufferedFrames] = {0};
+	// expanded texels are also copied back and compared with CPU conversion once uploaded
+	bool b_validate = false;
+	// stats of the last frame
+	uint32_t num_expanded = 0;
+	uint32_t num_batches = 0;
+
+	static TextureExpander* make(IRHIDevice* dev, bool b_validate) {
+		TextureExpander* ex = new TextureExpander();
+		ex->b_validate = b_validate;
+		ex->shader = SShader::loadCompute(dev, "vulkandrv/expand-palette.comp.spv.bin");
+
+		RHIDescriptorSetLayoutDesc dsl_desc[] = {
+			// palette and indices (task's staging buffer)
+			{RHIDescriptorType::kStorageBuffer, RHIShaderStageFlagBits::kCompute, 1, 0},
+			// expanded texels
+			{RHIDescriptorType::kStorageBuffer, RHIShaderStageFlagBits::kCompute, 1, 1},
+		};
+		ex->dsl = dev->CreateDescriptorSetLayout(dsl_desc, countof(dsl_desc));
+		ex->pipeline_layout = dev->CreatePipelineLayout(&ex->dsl, 1);
+		ex->pipeline = dev->CreateComputePipeline(&ex->shader->stages_[0], ex->pipeline_layout);
+		assert(ex->pipeline);
+
+		uint32_t usage = RHIBufferUsageFlagBits::kStorageBufferBit | RHIBufferUsageFlagBits::kTransferSrcBit;
+		ex->arena = dev->CreateBuffer(gUETexExpandArenaSize, usage,
+									  RHIMemoryPropertyFlagBits::kDeviceLocal, RHISharingMode::kExclusive);
+		assert(ex->arena);
+		return ex;
+	}
+
+	// Records expansions of the tasks from "first" on while they fit into the arena, returns end of
+	// the batch. Uploads of the batch have to be recorded before the next call.
+	size_t RecordBatch(IRHIDevice* dev, IRHICmdBuf* cb, const std::vector<TextureUploadTask*>& tasks,
+					   size_t first, int fb_idx) {
+		uint32_t arena_used = 0;
+		bool b_started = false;
+		size_t i = first;
+		for (; i < tasks.size(); ++i) {
+			TextureUploadTask* t = tasks[i];
+			if (!t->expanded_size)
+				continue;
+			// texture cache only expands textures which fit
+			assert((uint32_t)t->expanded_size <= gUETexExpandArenaSize);
+			const uint32_t offset = (arena_used + gUETexExpandAlignment - 1) & ~(gUETexExpandAlignment - 1);
+			if (offset + t->expanded_size > gUETexExpandArenaSize)
+				break;
+			arena_used = offset + t->expanded_size;
+
+			if (!b_started) {
+				// arena is only read by copies to images
+				cb->BufferBarrier(arena, RHIAccessFlagBits::kTransferRead, RHIPipelineStageFlags::kTransfer,
+								  RHIAccessFlagBits::kShaderWrite, RHIPipelineStageFlags::kComputeShader);
+				cb->BindComputePipeline(pipeline);
+				b_started = true;
+				num_batches++;
+			}
+
+			if (dsets[fb_idx].size() == dsets_used[fb_idx]) {
+				dsets[fb_idx].push_back(dev->AllocateDescriptorSet(dsl));
+			}
+			IRHIDescriptorSet* dset = dsets[fb_idx][dsets_used[fb_idx]++];
+
+			const uint32_t num_words = ((uint32_t)t->expanded_size / 4 + 3) / 4;
+			RHIDescriptorWriteDesc desc_write_desc[2];
+			RHIDescriptorWriteDescBuilder builder(desc_write_desc, countof(desc_write_desc));
+			builder.add(dset, 0, t->img_staging_buf, 0, kExpandIndexOffset + num_words * 4)
+				.add(dset, 1, arena, offset, t->expanded_size);
+			dev->UpdateDescriptorSet(desc_write_desc, builder.cur_index);
+
+			const IRHIDescriptorSet* sets[] = { dset };
+			cb->BindDescriptorSets(RHIPipelineBindPoint::kCompute, pipeline_layout, sets, countof(sets), 0,
+								   nullptr);
+			cb->Dispatch((num_words + gUETexExpandGroupSize - 1) / gUETexExpandGroupSize, 1, 1);
+
+			t->expanded_buf = arena;
+			t->expanded_offset = offset;
+			num_expanded++;
+		}
+
+		if (b_started) {
+			cb->BufferBarrier(arena, RHIAccessFlagBits::kShaderWrite, RHIPipelineStageFlags::kComputeShader,
+							  RHIAccessFlagBits::kTransferRead, RHIPipelineStageFlags::kTransfer);
+		}
+		if (b_started && b_validate) {
+			RecordReadbacks(dev, cb, tasks, first, i);
+		}
+		return i;
+	}
+
+	// copies expanded texels of the batch to buffers CPU can read, checked by Validate once uploaded
+	void RecordReadbacks(IRHIDevice* dev, IRHICmdBuf* cb, const std::vector<TextureUploadTask*>& tasks,
+						 size_t first, size_t end) {
+		for (size_t i = first; i < end; ++i) {
+			TextureUploadTask* t = tasks[i];
+			if (!t->expanded_size)
+				continue;
+			if (!t->readback_buf || t->readback_buf->Size() < (uint32_t)t->expanded_size) {
+				if (t->readback_buf) {
+					t->readback_buf->Unmap(dev);
+					t->readback_buf->Destroy(dev);
+				}
+				t->readback_buf = dev->CreateBuffer(
+					t->expanded_size, RHIBufferUsageFlagBits::kTransferDstBit,
+					RHIMemoryPropertyFlagBits::kHostVisible | RHIMemoryPropertyFlagBits::kHostCoherent,
+					RHISharingMode::kExclusive);
+				t->readback_buf->Map(dev, 0, t->expanded_size, 0);
+			}
+			cb->CopyBuffer(t->readback_buf, 0, arena, t->expanded_offset, t->expanded_size);
+			cb->BufferBarrier(t->readback_buf, RHIAccessFlagBits::kTransferWrite, RHIPipelineStageFlags::kTransfer,
+							  RHIAccessFlagBits::kHostRead, RHIPipelineStageFlags::kHost);
+		}
+	}
+
+	// called for each expanded task once its upload is finished
+	void Validate(const TextureUploadTask* t) {
+		if (!b_validate || !t->expanded_size)
+			return;
+		const int num_different = texture_validate_expansion(t);
+		if (num_different) {
+			log_error("TextureExpander: %dx%d texture differs from CPU conversion in %d texels\n",
+					  t->mips[0].width, t->mips[0].height, num_different);
+		}
+	}
+
+	// descriptor sets of the frame can be reused once its command buffer is finished
+	void EndFrame(int fb_idx) {
+		dsets_used[fb_idx] = 0;
+	}
+};
+
+TextureExpander* g_ue_tex_expander = nullptr;
+
 /**
 Attempts to read a property from the game's config file; on failure, a default is written (so it can be changed by the user) and returned.
 \param name A string identifying the config file options.
@@ -740,6 +2218,16 @@ void UVulkanRenderDevice::StaticConstructor()
 	new(GetClass(), L"FPSLimit", RF_Public) UIntProperty(CPP_PROPERTY(options.FPSLimit), TEXT("Options"), CPF_Config);
 	new(GetClass(), L"SimulateMultiPassTexturing", RF_Public) UBoolProperty(CPP_PROPERTY(VulkanOptions.simulateMultipassTexturing), TEXT("Options"), CPF_Config);
 	new(GetClass(), L"UnlimitedViewDistance", RF_Public) UBoolProperty(CPP_PROPERTY(options.unlimitedViewDistance), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"FanMode", RF_Public) UIntProperty(CPP_PROPERTY(options.fanMode), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"StaticWorldCache", RF_Public) UBoolProperty(CPP_PROPERTY(options.staticWorldCache), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"DepthPrepass", RF_Public) UBoolProperty(CPP_PROPERTY(options.depthPrepass), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"TwoPhaseMasked", RF_Public) UBoolProperty(CPP_PROPERTY(options.twoPhaseMasked), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"SurfaceCache", RF_Public) UBoolProperty(CPP_PROPERTY(options.surfaceCache), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"LightmapAtlas", RF_Public) UBoolProperty(CPP_PROPERTY(options.lightmapAtlas), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"AsyncTextureConversion", RF_Public) UBoolProperty(CPP_PROPERTY(options.asyncTextureConversion), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"DiskTextureCache", RF_Public) UBoolProperty(CPP_PROPERTY(options.diskTextureCache), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"PalettedTextures", RF_Public) UBoolProperty(CPP_PROPERTY(options.palettedTextures), TEXT("Options"), CPF_Config);
+	new(GetClass(), L"GpuTextureExpansion", RF_Public) UIntProperty(CPP_PROPERTY(options.gpuTextureExpansion), TEXT("Options"), CPF_Config);
 
 
 	new(GetClass(), L"ColorizeDetailTextures", RF_Public) UBoolProperty(CPP_PROPERTY(options.ColorizeDetailTextures), TEXT("Options"), CPF_Config);
@@ -795,7 +2283,7 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	URenderDevice::SpanBased = 0;
 	URenderDevice::FullscreenOnly = 0;
 	URenderDevice::SupportsFogMaps = 1;
-	URenderDevice::SupportsTC = 1;
+	// URenderDevice::SupportsTC depends on device features, set once device is created
 	URenderDevice::SupportsDistanceFog = 0;
 	URenderDevice::SupportsLazyTextures = 0;
 
@@ -813,20 +2301,35 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	options.FPSLimit = getOption(L"FPSLimit",100,false);
 	VulkanOptions.simulateMultipassTexturing = getOption(L"simulateMultipassTexturing",1,true);
 	options.unlimitedViewDistance = getOption(L"unlimitedViewDistance",0,true);
+	options.fanMode = getOption(L"FanMode",kFanModeCPUList,false);
+	options.staticWorldCache = getOption(L"StaticWorldCache",1,true);
+	options.depthPrepass = getOption(L"DepthPrepass",0,true);
+	options.twoPhaseMasked = getOption(L"TwoPhaseMasked",1,true);
+	options.surfaceCache = getOption(L"SurfaceCache",0,true);
+	options.lightmapAtlas = getOption(L"LightmapAtlas",1,true);
+	options.asyncTextureConversion = getOption(L"AsyncTextureConversion",1,true);
+	options.diskTextureCache = getOption(L"DiskTextureCache",0,true);
+	options.palettedTextures = getOption(L"PalettedTextures",0,true);
+	options.gpuTextureExpansion = getOption(L"GpuTextureExpansion",0,false);
 
 	if(options.unlimitedViewDistance)
 		zFar = 65536.0f;
 	else
 		zFar = 32760.0f;
 
-	g_texCache = TextureCache::makeCache();
-	texture_upload_task_init();
+	g_texCache = TextureCache::makeCache(false);
+	g_texCachePaletted = TextureCache::makeCache(true);
+	// next to the game executable, like the ini files
+	texture_upload_task_init(options.asyncTextureConversion != 0,
+							 options.diskTextureCache ? "VulkanDrvTextures.cache" : nullptr,
+							 options.gpuTextureExpansion ? gUETexExpandArenaSize : 0);
 	 
 	//Set parent options
 	URenderDevice::Viewport = InViewport;
 
 	//Do some nice compatibility fixing: set processor affinity to single-cpu
-	SetProcessAffinityMask(GetCurrentProcess(),0x1);
+	//Only game thread is pinned, so that texture conversion workers can use other cores
+	SetThreadAffinityMask(GetCurrentThread(),0x1);
 #if USE_GLAD_LOADER
 	int glad_vk_version = gladLoaderLoadVulkan(NULL, NULL, NULL);
     if (!glad_vk_version) {
@@ -850,6 +2353,12 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	g_vulkan_device->SetOnSwapChainRecreatedCallback(UVulkanRenderDevice::OnSwapChainRecreated, this);
 
 	IRHIDevice* device = g_vulkan_device;
+	ue_create_texture_placeholder(device);
+	if (options.gpuTextureExpansion) {
+		g_ue_tex_expander = TextureExpander::make(device, options.gpuTextureExpansion == 2);
+	}
+	// S3TC textures are uploaded as is, so only ask for them if we can sample them
+	URenderDevice::SupportsTC = device->GetProperties().textureCompressionBC ? 1 : 0;
 	for (size_t i = 0; i < kNumBufferedFrames; ++i) {
 		g_cmdbuf[i] = device->CreateCommandBuffer(RHIQueueType::kGraphics);
 	}
@@ -891,6 +2400,10 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 		{RHIDescriptorType::kUniformBuffer, RHIShaderStageFlagBits::kFragment | RHIShaderStageFlagBits::kVertex, 1, 4},
 		// per draw call
 		{RHIDescriptorType::kUniformBuffer, RHIShaderStageFlagBits::kFragment | RHIShaderStageFlagBits::kVertex, 1, 5},
+		// paletted diffuse indices
+		{RHIDescriptorType::kCombinedImageSampler, RHIShaderStageFlagBits::kFragment, 1, 6},
+		// palettes
+		{RHIDescriptorType::kCombinedImageSampler, RHIShaderStageFlagBits::kFragment, 1, 7},
 	};
 
 	RHIDescriptorSetLayoutDesc ue_dsl_gouraud_desc[] = {
@@ -910,16 +2423,36 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	g_ue_vs_ub_dsl = device->CreateDescriptorSetLayout(ue_vs_dsl_desc, countof(ue_vs_dsl_desc));
 
 	// create ue geometry buffers (one per swap chain len)
-	for (int i = 0; i < kNumBufferedFrames; ++i) {
-		g_ue_complex_vb[i] = SBuffer::makeVB(device, gUENumVert* sizeof(UEVertexComplex), nullptr);
-		g_ue_complex_vb_size[i] = 0;
-		g_ue_complex_ib[i] = SBuffer::makeIB(device, gUENumIndices* sizeof(uint32_t), nullptr);
-		g_ue_complex_ib_size[i] = 0;
+	const uint32_t geom_vertex_sizes[kGeomStreamCount] = { sizeof(UEVertexComplex), sizeof(UEVertexGouraud), sizeof(UEVertexLine) };
+	g_ue_geom = GeometryArena::make(geom_vertex_sizes, gUENumVert, gUENumIndices, device);
+
+	g_fan_mode = (FanMode)options.fanMode;
+	if (g_fan_mode < 0 || g_fan_mode >= kFanModeCount) {
+		log_error("Unknown FanMode: %d\n", options.fanMode);
+		g_fan_mode = kFanModeCPUList;
+	}
+	if (kFanModeNative == g_fan_mode && !device->GetProperties().triangleFans) {
+		g_fan_mode = kFanModeTable;
+	}
+	log_info("Fan mode: %d\n", g_fan_mode);
+
+	{
+		std::vector<uint16_t> fan_table((gUEMaxFanVerts - 2) * 3);
+		ue_fill_fan_index_table(fan_table.data(), gUEMaxFanVerts);
+		g_ue_fan_table_ib = SBuffer::makeIB(device, (uint32_t)(fan_table.size() * sizeof(uint16_t)),
+											fan_table.data());
+		g_ue_fan_table_uploaded = false;
+	}
+
+	if (options.staticWorldCache) {
+		g_ue_world_cache = StaticWorldCache::make(device);
+	}
 
-		g_ue_gouraud_vb[i] = SBuffer::makeVB(device, gUENumVert* sizeof(UEVertexGouraud), nullptr);
-		g_ue_gouraud_vb_size[i] = 0;
-		g_ue_gouraud_ib[i] = SBuffer::makeIB(device, gUENumIndices* sizeof(uint32_t), nullptr);
-		g_ue_gouraud_ib_size[i] = 0;
+	g_gpu_timer = GpuFrameTimer::make(device);
+
+	for (int i = 0; i < kNumBufferedFrames; ++i) {
+		g_ue_indirect_buf[i] = SBuffer::makeIndirect(
+			device, gUEIndirectDraws * sizeof(RHIDrawIndexedIndirectCommand), nullptr);
 
 		// TODO: check flags
 		g_ue_per_draw_call_uniforms[i] = device->CreateBuffer(
@@ -944,11 +2477,30 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	g_ue_complex_shader_alpha_test = SShader::load(device, "vulkandrv/complex-surface.vert.spv.bin",
 										"vulkandrv/complex-surface-atest.frag.spv.bin");
 
+	g_ue_complex_shader_no_detail = SShader::load(device, "vulkandrv/complex-surface.vert.spv.bin",
+										"vulkandrv/complex-surface-nodetail.frag.spv.bin");
+
+	g_ue_complex_shader_cached = SShader::load(device, "vulkandrv/complex-surface.vert.spv.bin",
+										"vulkandrv/complex-surface-cached.frag.spv.bin");
+
+	g_ue_surface_cache_build_shader = SShader::load(device, "vulkandrv/surface-cache-build.vert.spv.bin",
+										"vulkandrv/surface-cache-build.frag.spv.bin");
+
 	g_ue_gouraud_shader = SShader::load(device, "vulkandrv/gouraud-surface.vert.spv.bin",
 										"vulkandrv/gouraud-surface.frag.spv.bin");
 	g_ue_gouraud_shader_alpha_test = SShader::load(device, "vulkandrv/gouraud-surface.vert.spv.bin",
 										"vulkandrv/gouraud-surface-atest.frag.spv.bin");
 
+	g_ue_line_shader = SShader::load(device, "vulkandrv/line-point.vert.spv.bin",
+										"vulkandrv/line-point.frag.spv.bin");
+
+	g_ue_depth_only_shader = SShader::load(device, "vulkandrv/depth-only.vert.spv.bin");
+
+	g_ue_complex_masked_depth_shader = SShader::load(device, "vulkandrv/complex-surface.vert.spv.bin",
+										"vulkandrv/masked-depth.frag.spv.bin");
+	g_ue_gouraud_masked_depth_shader = SShader::load(device, "vulkandrv/gouraud-surface.vert.spv.bin",
+										"vulkandrv/masked-depth.frag.spv.bin");
+
 	RHIAttachmentDesc att_desc[2]; // color + depth
 	att_desc[0].format = device->GetSwapChainFormat();
 	att_desc[0].numSamples = 1;
@@ -1038,9 +2590,6 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	SShader* quad_shader = SShader::load(device, "vulkandrv/spir-v-model.vert.spv.bin",
 								  "vulkandrv/spir-v-model.frag.spv.bin");
 
-	SShader* fs_quad = SShader::load(device, "vulkandrv/fs-quad.vert.spv.bin",
-								  "vulkandrv/fs-quad.frag.spv.bin");
-
 	Image img;
 	const char *image_path = "./data/ut.bmp";
 	if (!img.loadFromFile(image_path)) {
@@ -1125,6 +2674,12 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	ue_vi_gouraud_state.vertexAttributeDescCount = countof(ue_gouraud_va_desc);
 	ue_vi_gouraud_state.pVertexAttributeDesc = ue_gouraud_va_desc;
 
+	RHIVertexInputState ue_vi_line_state;
+	ue_vi_line_state.vertexBindingDescCount = countof(ue_line_vert_bindings_desc);
+	ue_vi_line_state.pVertexBindingDesc = ue_line_vert_bindings_desc;
+	ue_vi_line_state.vertexAttributeDescCount = countof(ue_line_va_desc);
+	ue_vi_line_state.pVertexAttributeDesc = ue_line_va_desc;
+
 	RHIInputAssemblyState tri_ia_state;
 	tri_ia_state.primitiveRestartEnable = false;
 	tri_ia_state.topology = RHIPrimitiveTopology::kTriangleList;
@@ -1137,9 +2692,16 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	tris_ia_state.primitiveRestartEnable = false;
 	tris_ia_state.topology = RHIPrimitiveTopology::kTriangleList;
 
+	// several fans can be drawn by one draw call: either as triangle lists or as fans separated by
+	// restart index
 	RHIInputAssemblyState ue_ia_state;
-	ue_ia_state.primitiveRestartEnable = false;
-	ue_ia_state.topology = RHIPrimitiveTopology::kTriangleFan;
+	ue_ia_state.primitiveRestartEnable = kFanModeNative == g_fan_mode;
+	ue_ia_state.topology = kFanModeNative == g_fan_mode ? RHIPrimitiveTopology::kTriangleFan
+														: RHIPrimitiveTopology::kTriangleList;
+
+	RHIInputAssemblyState line_ia_state;
+	line_ia_state.primitiveRestartEnable = false;
+	line_ia_state.topology = RHIPrimitiveTopology::kLineList;
 
 	RHIScissor scissors;
 	scissors.x = 0;
@@ -1154,6 +2716,8 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	viewport.height = (float)NewY;
 	viewport.minDepth = 0.0f;
 	viewport.maxDepth = 1.0f;
+	// until first SetSceneNode
+	ue_set_current_viewport(viewport);
 
 	RHIViewportState viewport_state;
 	viewport_state.pScissors = &scissors;
@@ -1179,6 +2743,9 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	RHIRasterizationState ue_raster_state = raster_state;
 	ue_raster_state.frontFace = RHIFrontFace::kClockwise;
 
+	RHIRasterizationState line_raster_state = raster_state;
+	line_raster_state.cullMode = RHICullModeFlags::kNone;
+
 	RHIMultisampleState ms_state;
 	ms_state.alphaToCoverageEnable = false;
 	ms_state.alphaToOneEnable = false;
@@ -1212,13 +2779,20 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	RHIDepthStencilState ds_no_write_state = ds_state;
 	ds_no_write_state.depthWriteEnable = false;
 
-	RHIDepthStencilState ds_write_always = ds_state;
-	ds_write_always.depthCompareOp = RHICompareOp::kAlways;
+	RHIDepthStencilState ds_no_test_state = ds_state;
+	ds_no_test_state.depthTestEnable = false;
+	ds_no_test_state.depthWriteEnable = false;
 
+	// shading pass after depth pre-pass
+	RHIDepthStencilState ds_equal_state = ds_state;
+	ds_equal_state.depthCompareOp = RHICompareOp::kEqual;
+	ds_equal_state.depthWriteEnable = false;
 
+	// depth pre-pass
 	RHIColorBlendAttachmentState no_blend_no_color = create_blend_att_state(false, RHIBlendFactor::One, RHIBlendFactor::Zero);
 	no_blend_no_color.colorWriteMask = 0;
-	const RHIColorBlendState no_blend_no_color_state = { false, RHILogicOp::kCopy, 1, &no_blend_no_color, {0, 0, 0, 0}};
+	const RHIColorBlendState no_color_blend_state = { false, RHILogicOp::kCopy, 1, &no_blend_no_color, {0, 0, 0, 0}};
+
 
 	RHIDynamicState::Value dyn_state[] = { RHIDynamicState::kViewport };
 
@@ -1245,6 +2819,11 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	sampler_desc.maxLod = 10;
 	sampler_desc.unnormalizedCoordinates = false;
 	g_test_sampler = device->CreateSampler(sampler_desc);
+	// paletted textures are only fetched from (integer formats can not be filtered anyway)
+	sampler_desc.magFilter = RHIFilter::kNearest;
+	sampler_desc.minFilter = RHIFilter::kNearest;
+	sampler_desc.mipmapMode = RHISamplerMipmapMode::kNearest;
+	g_point_sampler = device->CreateSampler(sampler_desc);
 	IRHISampler* test_sampler2 = device->CreateSampler(sampler_desc);
 
 	g_uniform_buffer = device->CreateBuffer(
@@ -1279,7 +2858,6 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 
 	const IRHIDescriptorSetLayout* pipe_layout_desc[] = { g_my_layout, g_my_layout };
 	IRHIPipelineLayout *pipeline_layout = device->CreatePipelineLayout(pipe_layout_desc, countof(pipe_layout_desc));
-	IRHIPipelineLayout *pipeline_layout_empty = device->CreatePipelineLayout(nullptr, 0);
 
 	const IRHIDescriptorSetLayout* ue_complex_pipe_layout_desc[] = { g_ue_dsl_complex, g_ue_vs_ub_dsl};
 	IRHIPipelineLayout *ue_complex_pipeline_layout =
@@ -1289,16 +2867,16 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 	IRHIPipelineLayout *ue_gouraud_pipeline_layout =
 		device->CreatePipelineLayout(ue_gouraud_pipe_layout_desc, countof(ue_gouraud_pipe_layout_desc));
 
+	// depth pre-pass only needs per draw VS data
+	const IRHIDescriptorSetLayout* ue_depth_only_pipe_layout_desc[] = { g_ue_vs_ub_dsl };
+	IRHIPipelineLayout *ue_depth_only_pipeline_layout = device->CreatePipelineLayout(
+		ue_depth_only_pipe_layout_desc, countof(ue_depth_only_pipe_layout_desc));
+
 	g_tri_pipeline = device->CreateGraphicsPipeline(
 		tri_shader->stages_, countof(tri_shader->stages_), &tri_vi_state, &tri_ia_state,
 		&viewport_state, &raster_state, &ms_state, &ds_state, &no_blend_state, pipeline_layout,
 		dyn_state, countof(dyn_state), g_main_pass);
 
-	g_fs_clear_pipeline = device->CreateGraphicsPipeline(
-		fs_quad->stages_, countof(fs_quad->stages_), &tri_vi_state, &tri_ia_state,
-		&viewport_state, &raster_state, &ms_state, &ds_write_always, &no_blend_no_color_state, pipeline_layout_empty,
-		dyn_state, countof(dyn_state), g_main_pass);
-
 	g_quad_pipeline = device->CreateGraphicsPipeline(
 		quad_shader->stages_, countof(quad_shader->stages_), &quad_vi_state, &quad_ia_state,
 		&viewport_state, &raster_state, &ms_state, &ds_state, &no_blend_state, pipeline_layout,
@@ -1309,26 +2887,84 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 		&tris_ia_state, &viewport_state, &world_model_raster_state, &ms_state, &ds_state,
 		&no_blend_state, pipeline_layout, dyn_state, countof(dyn_state), g_main_pass);
 
-	for (uint8_t j = 0; j < 2; j++) {
-		const RHIDepthStencilState* depth_state = j ? &ds_write_state : &ds_no_write_state;
-		for (uint8_t i = 0; i < kPipeBlendCount; i++) {
+	// complex surfaces with and without detail texturing and ones drawn from surface cache
+	const SurfaceShader complex_surface[] = { kSurfaceShaderComplex, kSurfaceShaderComplexNoDetail,
+											  kSurfaceShaderComplexCached };
+	const SShader* const complex_shaders[] = { g_ue_complex_shader, g_ue_complex_shader_no_detail,
+											   g_ue_complex_shader_cached };
+	for (int s = 0; s < countof(complex_surface); ++s) {
+		for (uint8_t j = 0; j < 2; j++) {
+			const RHIDepthStencilState* depth_state = j ? &ds_write_state : &ds_no_write_state;
+			for (uint8_t i = 0; i < kPipeBlendCount; i++) {
+				IRHIGraphicsPipeline* pipeline = device->CreateGraphicsPipeline(
+					complex_shaders[s]->stages_, countof(complex_shaders[s]->stages_),
+					&ue_vi_complex_state, &ue_ia_state, &viewport_state, &ue_raster_state, &ms_state,
+					depth_state, g_blend_states[i], ue_complex_pipeline_layout, dyn_state,
+					countof(dyn_state), g_main_pass);
+
+				uint32_t key = make_key(complex_surface[s], (PipelineBlend)i, j!=0, !"ALPHA_TEST");
+				assert(g_ue_pipelines.count(key) == 0);
+				g_ue_pipelines.insert(std::make_pair(key, pipeline));
+			}
+		}
+
+		// opaque surfaces which were already drawn in depth pre-pass
+		IRHIGraphicsPipeline* pipeline = device->CreateGraphicsPipeline(
+			complex_shaders[s]->stages_, countof(complex_shaders[s]->stages_), &ue_vi_complex_state,
+			&ue_ia_state, &viewport_state, &ue_raster_state, &ms_state, &ds_equal_state,
+			g_blend_states[kPipeBlendNo], ue_complex_pipeline_layout, dyn_state, countof(dyn_state),
+			g_main_pass);
+
+		uint32_t key = make_key(complex_surface[s], kPipeBlendNo, "DEPTH_WRITE", !"ALPHA_TEST",
+								"DEPTH_TEST", "DEPTH_EQUAL");
+		assert(g_ue_pipelines.count(key) == 0);
+		g_ue_pipelines.insert(std::make_pair(key, pipeline));
+	}
+
+	// depth pre-pass, same vertex input and assembly as complex surfaces
+	{
+		IRHIGraphicsPipeline* pipeline = device->CreateGraphicsPipeline(
+			g_ue_depth_only_shader->stages_, g_ue_depth_only_shader->num_stages_,
+			&ue_vi_complex_state, &ue_ia_state, &viewport_state, &ue_raster_state, &ms_state,
+			&ds_write_state, &no_color_blend_state, ue_depth_only_pipeline_layout, dyn_state,
+			countof(dyn_state), g_main_pass);
+
+		uint32_t key = make_key(kSurfaceShaderDepthOnly, kPipeBlendNo, "DEPTH_WRITE", !"ALPHA_TEST");
+		assert(g_ue_pipelines.count(key) == 0);
+		g_ue_pipelines.insert(std::make_pair(key, pipeline));
+	}
+
+	// two phase masked surfaces: alpha tested depth and then alpha tested colour with EQUAL depth test
+	{
+		const SurfaceShader masked_surface[] = { kSurfaceShaderMaskedDepthComplex, kSurfaceShaderMaskedDepthGouraud };
+		const SShader* const masked_shaders[] = { g_ue_complex_masked_depth_shader, g_ue_gouraud_masked_depth_shader };
+		const RHIVertexInputState* const masked_vi_states[] = { &ue_vi_complex_state, &ue_vi_gouraud_state };
+		const IRHIPipelineLayout * const masked_layouts[] = { ue_complex_pipeline_layout, ue_gouraud_pipeline_layout };
+		for (int s = 0; s < countof(masked_surface); ++s) {
 			IRHIGraphicsPipeline* pipeline = device->CreateGraphicsPipeline(
-				g_ue_complex_shader->stages_, countof(g_ue_complex_shader->stages_), &ue_vi_complex_state,
-				&ue_ia_state, &viewport_state, &ue_raster_state, &ms_state, depth_state, g_blend_states[i],
-				ue_complex_pipeline_layout, dyn_state, countof(dyn_state), g_main_pass);
+				masked_shaders[s]->stages_, countof(masked_shaders[s]->stages_), masked_vi_states[s],
+				&ue_ia_state, &viewport_state, &ue_raster_state, &ms_state, &ds_write_state,
+				&no_color_blend_state, masked_layouts[s], dyn_state, countof(dyn_state), g_main_pass);
 
-			uint32_t key = make_key(kSurfaceShaderComplex, (PipelineBlend)i, j!=0, !"ALPHA_TEST");
+			uint32_t key = make_key(masked_surface[s], kPipeBlendNo, "DEPTH_WRITE", "ALPHA_TEST");
+			assert(g_ue_pipelines.count(key) == 0);
+			g_ue_pipelines.insert(std::make_pair(key, pipeline));
+		}
+
+		const SurfaceShader colour_surface[] = { kSurfaceShaderComplex, kSurfaceShaderGouraud };
+		const SShader* const colour_shaders[] = { g_ue_complex_shader_alpha_test, g_ue_gouraud_shader_alpha_test };
+		for (int s = 0; s < countof(colour_surface); ++s) {
+			IRHIGraphicsPipeline* pipeline = device->CreateGraphicsPipeline(
+				colour_shaders[s]->stages_, countof(colour_shaders[s]->stages_), masked_vi_states[s],
+				&ue_ia_state, &viewport_state, &ue_raster_state, &ms_state, &ds_equal_state,
+				g_blend_states[kPipeBlendNo], masked_layouts[s], dyn_state, countof(dyn_state),
+				g_main_pass);
+
+			uint32_t key = make_key(colour_surface[s], kPipeBlendNo, "DEPTH_WRITE", "ALPHA_TEST",
+									"DEPTH_TEST", "DEPTH_EQUAL");
 			assert(g_ue_pipelines.count(key) == 0);
 			g_ue_pipelines.insert(std::make_pair(key, pipeline));
 		}
-	}
-	// clear Z
-	{
-		// yeah, we actually do depth write, but we need to have a separate flag for depth clear
-		// (which is a different pipeline meaning we overwrite everyting)
-		uint32_t clear_z_key = make_key(kSurfaceShaderClearDepth, kPipeBlendNo, !"DEPTH_WRITE", !"ALPHA_TEST");
-		assert(g_ue_pipelines.count(clear_z_key) == 0);
-		g_ue_pipelines.insert(std::make_pair(clear_z_key, g_fs_clear_pipeline));
 	}
 
 	// alpha test
@@ -1374,6 +3010,104 @@ UBOOL UVulkanRenderDevice::Init(UViewport* InViewport, INT NewX, INT NewY, INT N
 		}
 	}
 
+	// lines and points: never write depth, depth cued ones are depth tested
+	{
+		const SurfaceShader line_shaders[] = { kSurfaceShaderLine, kSurfaceShaderPoint };
+		const RHIInputAssemblyState* line_ia_states[] = { &line_ia_state, &tris_ia_state };
+		const PipelineBlend line_blends[] = { kPipeBlendNo, kPipeBlendTranslucent };
+		for (int s = 0; s < countof(line_shaders); ++s) {
+			for (int b = 0; b < countof(line_blends); ++b) {
+				for (int d = 0; d < 2; ++d) {
+					IRHIGraphicsPipeline *pipeline = device->CreateGraphicsPipeline(
+						g_ue_line_shader->stages_, countof(g_ue_line_shader->stages_),
+						&ue_vi_line_state, line_ia_states[s], &viewport_state, &line_raster_state,
+						&ms_state, d ? &ds_no_write_state : &ds_no_test_state,
+						g_blend_states[line_blends[b]], ue_gouraud_pipeline_layout, dyn_state,
+						countof(dyn_state), g_main_pass);
+
+					uint32_t key = make_key(line_shaders[s], line_blends[b], !"DEPTH_WRITE",
+											!"ALPHA_TEST", d != 0);
+					assert(g_ue_pipelines.count(key) == 0);
+					g_ue_pipelines.insert(std::make_pair(key, pipeline));
+				}
+			}
+		}
+	}
+
+	// surface cache tiles, drawn into atlas pages before the main pass which samples them
+	{
+		RHIAttachmentDesc sc_att_desc;
+		sc_att_desc.format = RHIFormat::kR8G8B8A8_UNORM;
+		sc_att_desc.numSamples = 1;
+		// only tiles being built are drawn, the rest of the page is kept
+		sc_att_desc.loadOp = RHIAttachmentLoadOp::kLoad;
+		sc_att_desc.storeOp = RHIAttachmentStoreOp::kStore;
+		sc_att_desc.stencilLoadOp = RHIAttachmentLoadOp::kDoNotCare;
+		sc_att_desc.stencilStoreOp = RHIAttachmentStoreOp::kDoNotCare;
+		sc_att_desc.initialLayout = RHIImageLayout::kShaderReadOnlyOptimal;
+		sc_att_desc.finalLayout = RHIImageLayout::kShaderReadOnlyOptimal;
+
+		RHIAttachmentRef sc_color_att_ref = {0, RHIImageLayout::kColorOptimal};
+
+		RHISubpassDesc sc_sp_desc;
+		sc_sp_desc.bindPoint = RHIPipelineBindPoint::kGraphics;
+		sc_sp_desc.colorAttachmentCount = 1;
+		sc_sp_desc.colorAttachments = &sc_color_att_ref;
+		sc_sp_desc.depthStencilAttachment = nullptr;
+		sc_sp_desc.inputAttachmentCount = 0;
+		sc_sp_desc.inputAttachments = nullptr;
+		sc_sp_desc.preserveAttachmentCount = 0;
+		sc_sp_desc.preserveAttachments = nullptr;
+
+		// previous frames sample the pages
+		RHISubpassDependency sc_dep0;
+		sc_dep0.srcSubpass = kSubpassExternal;
+		sc_dep0.dstSubpass = 0;
+		sc_dep0.srcStageMask = RHIPipelineStageFlags::kFragmentShader;
+		sc_dep0.dstStageMask = RHIPipelineStageFlags::kColorAttachmentOutput;
+		sc_dep0.srcAccessMask = RHIAccessFlagBits::kShaderRead;
+		sc_dep0.dstAccessMask = RHIAccessFlagBits::kColorAttachmentWrite;
+		sc_dep0.dependencyFlags = 0;
+
+		// and the main pass of this one
+		RHISubpassDependency sc_dep1;
+		sc_dep1.srcSubpass = 0;
+		sc_dep1.dstSubpass = kSubpassExternal;
+		sc_dep1.srcStageMask = RHIPipelineStageFlags::kColorAttachmentOutput;
+		sc_dep1.dstStageMask = RHIPipelineStageFlags::kFragmentShader;
+		sc_dep1.srcAccessMask = RHIAccessFlagBits::kColorAttachmentWrite;
+		sc_dep1.dstAccessMask = RHIAccessFlagBits::kShaderRead;
+		sc_dep1.dependencyFlags = 0;
+
+		RHISubpassDependency sc_deps[] = { sc_dep0, sc_dep1 };
+
+		RHIRenderPassDesc sc_rp_desc;
+		sc_rp_desc.attachmentCount = 1;
+		sc_rp_desc.attachmentDesc = &sc_att_desc;
+		sc_rp_desc.subpassCount = 1;
+		sc_rp_desc.subpassDesc = &sc_sp_desc;
+		sc_rp_desc.dependencyCount = countof(sc_deps);
+		sc_rp_desc.dependencies = sc_deps;
+		g_ue_surface_cache_pass = device->CreateRenderPass(&sc_rp_desc);
+
+		RHIVertexInputState ue_vi_surface_cache_state;
+		ue_vi_surface_cache_state.vertexBindingDescCount = countof(ue_surface_cache_vert_bindings_desc);
+		ue_vi_surface_cache_state.pVertexBindingDesc = ue_surface_cache_vert_bindings_desc;
+		ue_vi_surface_cache_state.vertexAttributeDescCount = countof(ue_surface_cache_va_desc);
+		ue_vi_surface_cache_state.pVertexAttributeDesc = ue_surface_cache_va_desc;
+
+		// uses diffuse and lightmap bindings of complex surface set
+		const IRHIDescriptorSetLayout* ue_surface_cache_pipe_layout_desc[] = { g_ue_dsl_complex };
+		IRHIPipelineLayout *ue_surface_cache_pipeline_layout = device->CreatePipelineLayout(
+			ue_surface_cache_pipe_layout_desc, countof(ue_surface_cache_pipe_layout_desc));
+
+		g_ue_surface_cache_pipeline = device->CreateGraphicsPipeline(
+			g_ue_surface_cache_build_shader->stages_, countof(g_ue_surface_cache_build_shader->stages_),
+			&ue_vi_surface_cache_state, &tris_ia_state, &viewport_state, &line_raster_state,
+			&ms_state, &ds_no_test_state, &no_blend_state, ue_surface_cache_pipeline_layout,
+			dyn_state, countof(dyn_state), g_ue_surface_cache_pass);
+	}
+
 	
 
 	if (!UVulkanRenderDevice::SetRes(NewX, NewY, NewColorBytes, Fullscreen)) {
@@ -1443,9 +3177,11 @@ void UVulkanRenderDevice::Exit()
 
 	g_tex_upload_tasks.clear();
 	g_tex_upload_in_progress.clear();
+	// waits for conversions in flight, so before workers are stopped
+	TextureCache::destroy(g_texCache);
+	TextureCache::destroy(g_texCachePaletted);
 	texture_upload_task_fini();
 
-	TextureCache::destroy(g_texCache);
 	delete g_vulkan_device;
 	g_ue_pipelines.clear();
 	assert(g_draw_calls.size() == 0);
@@ -1474,7 +3210,14 @@ void UVulkanRenderDevice::Flush(UBOOL AllowPrecache)
 	g_tex_upload_tasks.clear();
 	g_tex_upload_in_progress.clear();
 	TextureCache::destroy(g_texCache);
-	g_texCache = TextureCache::makeCache();
+	TextureCache::destroy(g_texCachePaletted);
+	g_texCache = TextureCache::makeCache(false);
+	g_texCachePaletted = TextureCache::makeCache(true);
+
+	// lightmap cache ids of the new level may repeat the ones of the old level
+	if (g_ue_lightmap_atlas) {
+		g_ue_lightmap_atlas->clear();
+	}
 }
 #endif
 
@@ -1536,7 +3279,7 @@ void UVulkanRenderDevice::Lock(FPlane FlashScale, FPlane FlashFog, FPlane Screen
 		m_detailTextureColor4ub = 0x00408040;
 	}
 	else {
-		m_detailTextureColor4ub = 0x00808080;
+		m_detailTextureColor4ub = gUENeutralDetailTexColor;
 	}
 
 
@@ -1553,6 +3296,18 @@ void UVulkanRenderDevice::Lock(FPlane FlashScale, FPlane FlashFog, FPlane Screen
 
 	cb->Begin();
 
+	if (g_gpu_timer) {
+		g_gpu_timer->BeginFrame(dev, cb, g_curFBIdx);
+	}
+
+	// created on first use, surface cache can be enabled at runtime
+	if (options.surfaceCache && !g_ue_surface_cache) {
+		g_ue_surface_cache = SurfaceCache::make(dev, g_ue_dsl_complex);
+	}
+	if (options.lightmapAtlas && !g_ue_lightmap_atlas) {
+		g_ue_lightmap_atlas = LightmapAtlas::make(dev);
+	}
+
 	static float sec = 0.0f;
 	sec += deltaTime;
 	static vec4 color = vec4(1, 0, 0, 0);
@@ -1580,20 +3335,167 @@ void UVulkanRenderDevice::Lock(FPlane FlashScale, FPlane FlashFog, FPlane Screen
 			b_cube_copied = true;
 		}
 
-		update_uniform_staging_buf(g_curFBIdx, dev);
+		update_uniform_staging_buf(g_curFBIdx, dev);
+
+		// update uniforms device buffer (using g_curFBIdx for indexing, assume they are
+		// synchronized and there are same numbers of both)
+		cb->CopyBuffer(g_uniform_buffer, 0, g_uniform_staging_buffer[g_curFBIdx], 0, sizeof(PerFrameUniforms));
+		cb->BufferBarrier(g_uniform_buffer, (uint32_t)RHIAccessFlagBits::kTransferWrite,
+						  RHIPipelineStageFlags::kTransfer, (uint32_t)RHIAccessFlagBits::kUniformRead,
+						  RHIPipelineStageFlags::kVertexShader);
+		cb->SetEvent(g_uniform_buffer_copy_event, RHIPipelineStageFlags::kVertexShader);
+
+	}
+
+
+	sanity_lock_cnt++;
+}
+
+// first index and vertex offset of an indexed draw call
+static void ue_get_draw_indexed_args(const ComplexSurfaceDrawCall& dc, uint32_t* first_index,
+									 int32_t* vertex_offset) {
+	const GeometryStream& gs = g_ue_geom->streams[get_geom_stream(dc.surface_shader)];
+	// indices of cached geometry are already absolute
+	const uint32_t base_vertex = dc.b_static_geom ? 0 : gs.base_vertex;
+	if (kFanModeTable == g_fan_mode) {
+		*first_index = 0;
+		*vertex_offset = (int32_t)(base_vertex + dc.vb_offset);
+	} else {
+		*first_index = gs.base_index + dc.ib_offset;
+		*vertex_offset = (int32_t)base_vertex;
+	}
+}
+
+// fills indirect buffer with commands for all indexed draw calls of the frame
+static void ue_write_indirect_commands(int idx) {
+	RHIDrawIndexedIndirectCommand* cmds =
+		(RHIDrawIndexedIndirectCommand*)g_ue_indirect_buf[idx]->getMappedPtr();
+	const uint32_t num_draw_calls = (uint32_t)g_draw_calls.size();
+	const uint32_t count = num_draw_calls < gUEIndirectDraws ? num_draw_calls : gUEIndirectDraws;
+	for (uint32_t i = 0; i < count; ++i) {
+		const ComplexSurfaceDrawCall& dc = g_draw_calls[i];
+		if (!dc.num_indices) {
+			memset(&cmds[i], 0, sizeof(RHIDrawIndexedIndirectCommand));
+			continue;
+		}
+		cmds[i].indexCount = dc.num_indices;
+		cmds[i].instanceCount = 1;
+		ue_get_draw_indexed_args(dc, &cmds[i].firstIndex, &cmds[i].vertexOffset);
+		cmds[i].firstInstance = 0;
+	}
+}
+
+// draw calls are in same bucket if they can be drawn with the same pipeline, descriptor sets and
+// viewport (e.g. polys of a single facet)
+static bool ue_same_draw_state(const ComplexSurfaceDrawCall& a, const ComplexSurfaceDrawCall& b) {
+	return a.surface_shader == b.surface_shader && a.pipeline_blend == b.pipeline_blend &&
+		   a.b_depth_write == b.b_depth_write && a.b_alpha_test == b.b_alpha_test &&
+		   a.b_depth_test == b.b_depth_test && a.b_static_geom == b.b_static_geom &&
+		   a.vs_ub_idx == b.vs_ub_idx && a.diffuse == b.diffuse && a.lightmap == b.lightmap &&
+		   a.detail == b.detail && a.macro == b.macro && a.diffuse_index == b.diffuse_index &&
+		   a.viewport_idx == b.viewport_idx;
+}
 
-		// update uniforms device buffer (using g_curFBIdx for indexing, assume they are
-		// synchronized and there are same numbers of both)
-		cb->CopyBuffer(g_uniform_buffer, 0, g_uniform_staging_buffer[g_curFBIdx], 0, sizeof(PerFrameUniforms));
-		cb->BufferBarrier(g_uniform_buffer, (uint32_t)RHIAccessFlagBits::kTransferWrite,
-						  RHIPipelineStageFlags::kTransfer, (uint32_t)RHIAccessFlagBits::kUniformRead,
-						  RHIPipelineStageFlags::kVertexShader);
-		cb->SetEvent(g_uniform_buffer_copy_event, RHIPipelineStageFlags::kVertexShader);
+// returns number of consecutive indexed draw calls starting from "first" which share the same state
+static int get_draw_bucket_size(int first) {
+	const ComplexSurfaceDrawCall& dc = g_draw_calls[first];
+	if (!dc.num_indices || !dc.dset || (uint32_t)first >= gUEIndirectDraws)
+		return 1;
 
+	const uint32_t num_draw_calls = (uint32_t)g_draw_calls.size();
+	const int end = (int)(num_draw_calls < gUEIndirectDraws ? num_draw_calls : gUEIndirectDraws);
+	int i = first + 1;
+	while (i < end && g_draw_calls[i].num_indices && ue_same_draw_state(dc, g_draw_calls[i])) {
+		++i;
 	}
+	return i - first;
+}
 
+// Opaque complex surfaces which get their depth in depth pre-pass and then are shaded with EQUAL
+// depth test. Masked ones are not there as pre-pass does not run fragment shader to discard.
+static bool ue_is_depth_prepass_draw(const ComplexSurfaceDrawCall& dc) {
+	return (kSurfaceShaderComplex == dc.surface_shader ||
+			kSurfaceShaderComplexNoDetail == dc.surface_shader ||
+			kSurfaceShaderComplexCached == dc.surface_shader) &&
+		   kPipeBlendNo == dc.pipeline_blend && dc.b_depth_write && !dc.b_alpha_test &&
+		   dc.b_depth_test;
+}
 
-	sanity_lock_cnt++;
+// Masked surfaces which are drawn in two phases: alpha tested depth only and then colour with
+// EQUAL depth test, so that occluded fragments are not shaded. Colour pass still discards
+// transparent texels: where earlier coplanar geometry has the same depth they pass EQUAL test too.
+// Alpha tested and blended ones are left as is.
+static bool ue_is_two_phase_masked_draw(const ComplexSurfaceDrawCall& dc) {
+	return (kSurfaceShaderComplex == dc.surface_shader ||
+			kSurfaceShaderGouraud == dc.surface_shader) &&
+		   kPipeBlendNo == dc.pipeline_blend && dc.b_depth_write && dc.b_alpha_test &&
+		   dc.b_depth_test;
+}
+
+// Records draws of a bucket of draw calls sharing the same state, see get_draw_bucket_size()
+static void ue_draw_bucket(IRHICmdBuf* cb, int first, int bucket_size, bool b_multi_draw) {
+	const ComplexSurfaceDrawCall& dc = g_draw_calls[first];
+	if (bucket_size > 1 && b_multi_draw) {
+		cb->DrawIndexedIndirect(g_ue_indirect_buf[g_curFBIdx]->device_buf_,
+								first * sizeof(RHIDrawIndexedIndirectCommand), bucket_size,
+								sizeof(RHIDrawIndexedIndirectCommand));
+	} else if (dc.num_indices) {
+		for (int j = first; j < first + bucket_size; ++j) {
+			uint32_t first_index;
+			int32_t vertex_offset;
+			ue_get_draw_indexed_args(g_draw_calls[j], &first_index, &vertex_offset);
+			cb->DrawIndexed(g_draw_calls[j].num_indices, 1, first_index, vertex_offset, 0);
+		}
+	} else {
+		// lines and points are not indexed
+		const GeometryStream& gs = g_ue_geom->streams[get_geom_stream(dc.surface_shader)];
+		cb->Draw(dc.num_vertices, 1, gs.base_vertex + dc.vb_offset, 0);
+	}
+}
+
+// Draws depth of pre-pass draw calls in [first, end) range, updates currently bound VB and viewport
+static void ue_record_depth_prepass(IRHICmdBuf* cb, int first, int end, IRHIBuffer*& bound_vb,
+									int& bound_viewport_idx) {
+	const uint32_t key = make_key(kSurfaceShaderDepthOnly, kPipeBlendNo, "DEPTH_WRITE", !"ALPHA_TEST");
+	assert(g_ue_pipelines.count(key));
+	IRHIGraphicsPipeline* pipeline = g_ue_pipelines[key];
+	bool b_pipeline_bound = false;
+	uint32_t bound_vs_ub_idx = 0xFFFFFFFF;
+
+	for (int i = first; i < end; ++i) {
+		const ComplexSurfaceDrawCall& dc = g_draw_calls[i];
+		if (!ue_is_depth_prepass_draw(dc))
+			continue;
+
+		if (!b_pipeline_bound) {
+			cb->BindPipeline(RHIPipelineBindPoint::kGraphics, pipeline);
+			b_pipeline_bound = true;
+		}
+
+		IRHIBuffer* dc_vb = dc.b_static_geom ? g_ue_world_cache->vb->device_buf_
+											 : g_ue_geom->vb[g_curFBIdx]->device_buf_;
+		if (dc_vb != bound_vb) {
+			bound_vb = dc_vb;
+			cb->BindVertexBuffers(&bound_vb, 0, 1);
+		}
+		if (dc.viewport_idx != bound_viewport_idx) {
+			cb->SetViewport(&g_frame_viewports[dc.viewport_idx], 1);
+			bound_viewport_idx = dc.viewport_idx;
+		}
+		// polygons of one facet share VS data
+		if (dc.vs_ub_idx != bound_vs_ub_idx) {
+			const IRHIDescriptorSet *sets[] = {g_ue_complex_vs_ub->dset[g_curFBIdx]};
+			uint32_t dyn_offsets[] = {dc.vs_ub_idx * g_ue_complex_vs_ub->el_size};
+			cb->BindDescriptorSets(RHIPipelineBindPoint::kGraphics, pipeline->Layout(), sets,
+								   countof(sets), countof(dyn_offsets), dyn_offsets);
+			bound_vs_ub_idx = dc.vs_ub_idx;
+		}
+
+		uint32_t first_index;
+		int32_t vertex_offset;
+		ue_get_draw_indexed_args(dc, &first_index, &vertex_offset);
+		cb->DrawIndexed(dc.num_indices, 1, first_index, vertex_offset, 0);
+	}
 }
 
 void UVulkanRenderDevice::Unlock(UBOOL Blit)
@@ -1612,14 +3514,75 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 	// GetSwapChainWidthHeight() ?
 	const IRHIImage* fb_image = dev->GetCurrentSwapChainImage();
 
-	for (int i = 0; i < g_tex_upload_tasks.size(); ++i) {
+	if (g_tex_placeholder_task) {
+		g_tex_upload_tasks.push_back(g_tex_placeholder_task);
+		g_tex_upload_tasks.push_back(g_tex_dummy_index_task);
+		g_tex_placeholder_task = nullptr;
+		g_tex_dummy_index_task = nullptr;
+	}
+	// precaching happens behind the load screen: finish all of its conversions, so that the batch
+	// goes into this command buffer and not into the first frames of gameplay
+	LARGE_INTEGER precache_converted;
+	if (g_precache_batch.num_textures) {
+		g_texCache->waitConverted();
+		QueryPerformanceCounter(&precache_converted);
+	}
+
+	// textures converted by workers are uploaded now and used from the next frame on
+	g_texCache->collectConverted(g_tex_upload_tasks);
+	// palettes of textures cached or changed this frame
+	TextureUploadTask* palette_task;
+	if (g_texCachePaletted->uploadPalettes(dev, &palette_task)) {
+		g_tex_upload_tasks.push_back(palette_task);
+	}
+
+	if (g_precache_batch.num_textures) {
+		const double ms = 1000.0 * (double)(precache_converted.QuadPart - g_precache_batch.start.QuadPart) /
+						  (double)perfCounterFreq.QuadPart;
+		uint64_t staging_bytes = 0;
+		for (const TextureUploadTask* t : g_tex_upload_tasks) {
+			staging_bytes += t->size;
+		}
+		log_info("Precache: %d textures (%d already cached) converted in %.1f ms, uploading %d "
+				 "textures, %llu KB in one batch\n",
+				 g_precache_batch.num_textures, g_precache_batch.num_skipped, ms,
+				 (int)g_tex_upload_tasks.size(), staging_bytes / 1024);
+		g_precache_batch.num_textures = 0;
+		g_precache_batch.num_skipped = 0;
+	}
+
+	if (g_ue_tex_expander) {
+		g_ue_tex_expander->num_expanded = 0;
+		g_ue_tex_expander->num_batches = 0;
+	}
+	// GPU expanded textures go in batches which fit into expander's arena, the rest in one
+	size_t batch_end = 0;
+	for (size_t i = 0; i < g_tex_upload_tasks.size(); ++i) {
+		if (i == batch_end) {
+			batch_end = g_ue_tex_expander ? g_ue_tex_expander->RecordBatch(dev, cb, g_tex_upload_tasks, i, g_curFBIdx)
+										  : g_tex_upload_tasks.size();
+			assert(batch_end > i);
+		}
 		TextureUploadTask* t = g_tex_upload_tasks[i];
 		if (t->is_update)
 			cb->Barrier_ShaderReadToTransfer(t->image);
 		else
 			cb->Barrier_UndefinedToTransfer(t->image);
-		cb->CopyBufferToImage2D(t->image, t->img_staging_buf);
-		cb->Barrier_TransferToShaderRead(t->image);
+		if (t->expanded_size) {
+			assert(t->expanded_buf);
+			RHIBufferImageCopy regions[TextureUploadTask::kMaxMips];
+			for (int m = 0; m < t->num_mips; ++m) {
+				regions[m] = t->mips[m];
+				regions[m].bufferOffset += t->expanded_offset;
+			}
+			cb->CopyBufferToImage2D(t->image, t->expanded_buf, regions, t->num_mips);
+		} else {
+			cb->CopyBufferToImage2D(t->image, t->img_staging_buf, t->mips, t->num_mips);
+		}
+		if ((uint32_t)t->num_mips < t->image->GetDesc().numMips)
+			cb->GenerateMips(t->image, t->num_mips);
+		else
+			cb->Barrier_TransferToShaderRead(t->image);
 		cb->SetEvent(t->img_copy_event, RHIPipelineStageFlags::kFragmentShader);
 
 		assert(g_tex_upload_in_progress.end() ==
@@ -1633,6 +3596,9 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 	const auto e = g_tex_upload_in_progress.end();
 	for (auto it = b; it != e; ++it) {
 		if ((*it)->img_copy_event->IsSet(dev)) {
+			if (g_ue_tex_expander) {
+				g_ue_tex_expander->Validate(*it);
+			}
 			(*it)->release();
 			*it = nullptr;
 		}
@@ -1644,22 +3610,49 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 		ue_update_per_frame_uniforms(g_curFBIdx, dev, m_detailTextureColor4ub);
 	}
 
-	if (!g_draw_calls.empty()) {
+	if (!g_ue_geom->empty(g_curFBIdx)) {
+		g_ue_geom->CopyToGPU(g_curFBIdx, dev, cb);
+	}
+
+	if (g_ue_world_cache) {
+		g_ue_world_cache->CopyToGPU(dev, cb);
+	}
+
+	if (!g_ue_fan_table_uploaded) {
+		g_ue_fan_table_ib->CopyToGPU(dev, cb);
+		g_ue_fan_table_uploaded = true;
+	}
+
+	if (g_ue_complex_vs_ub->size[g_curFBIdx]) {
 		// TODO: do not copy whole array! only actual filled frame data 
-		g_ue_complex_vb[g_curFBIdx]->CopyToGPU(dev, cb);
-		g_ue_complex_ib[g_curFBIdx]->CopyToGPU(dev, cb);
 		g_ue_complex_vs_ub->buf[g_curFBIdx]->CopyToGPU(dev, cb);
 	}
 
-	//if (!g_gouraud_draw_calls.empty()) {
-	if(g_ue_gouraud_ib_size[g_curFBIdx])
-	{
+	if (g_ue_gouraud_vs_ub->size[g_curFBIdx]) {
 		// TODO: do not copy whole array! only actual filled frame data 
-		g_ue_gouraud_vb[g_curFBIdx]->CopyToGPU(dev, cb);
-		g_ue_gouraud_ib[g_curFBIdx]->CopyToGPU(dev, cb);
 		g_ue_gouraud_vs_ub->buf[g_curFBIdx]->CopyToGPU(dev, cb);
 	}
 
+	if (!g_draw_calls.empty()) {
+		ue_write_indirect_commands(g_curFBIdx);
+		// only commands written this frame
+		const uint32_t num_cmds = (uint32_t)g_draw_calls.size() < gUEIndirectDraws
+									  ? (uint32_t)g_draw_calls.size()
+									  : gUEIndirectDraws;
+		const uint32_t offset = 0;
+		const uint32_t size = num_cmds * sizeof(RHIDrawIndexedIndirectCommand);
+		g_ue_indirect_buf[g_curFBIdx]->CopyRangesToGPU(dev, cb, &offset, &size, 1);
+	}
+
+	if (g_ue_lightmap_atlas) {
+		g_ue_lightmap_atlas->RecordUploads(cb, g_curFBIdx);
+	}
+
+	// after texture uploads, as tiles are built from those textures
+	if (g_ue_surface_cache) {
+		g_ue_surface_cache->RecordBuilds(dev, cb, g_curFBIdx);
+	}
+
 	//cb->Barrier_PresentToClear(fb_image);
 	//cb->Barrier_PresentToClear(cur_ds->GetImage());
 	//vec4 color = vec4(1, 0, 0, 0);
@@ -1717,35 +3710,107 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 
 	if (!g_draw_calls.empty()) {
 
+		const bool b_multi_draw = dev->GetProperties().multiDrawIndirect;
+		// all surface types share the arena, bind it once
+		if (kFanModeTable == g_fan_mode) {
+			cb->BindIndexBuffer(g_ue_fan_table_ib->device_buf_, 0, RHIIndexType::kUint16);
+		} else {
+			cb->BindIndexBuffer(g_ue_geom->ib[g_curFBIdx]->device_buf_, 0, RHIIndexType::kUint32);
+		}
+		IRHIBuffer* bound_vb = g_ue_geom->vb[g_curFBIdx]->device_buf_;
+		cb->BindVertexBuffers(&bound_vb, 0, 1);
+
+		// viewport is dynamic state, so it survives pipeline changes
+		int bound_viewport_idx = -1;
+
+		// read every frame, so they can be toggled at runtime
+		const bool b_depth_prepass = !!options.depthPrepass;
+		const bool b_two_phase_masked = !!options.twoPhaseMasked;
+		// draw calls before it already have their depth laid down by pre-pass
+		int prepass_end = 0;
 
 		const int num_draw_calls = (int)g_draw_calls.size();
-		for (int i = 0; i < num_draw_calls; i++) {
+		for (int i = 0; i < num_draw_calls;) {
 			const ComplexSurfaceDrawCall& dc = g_draw_calls[i];
+			if (kSurfaceShaderClearDepth == dc.surface_shader) {
+				// clear depth only in the viewport of the draw call, does not need any state
+				const RHIViewport& vp = g_frame_viewports[dc.viewport_idx];
+				RHIScissor rect;
+				rect.x = (int32_t)vp.x;
+				rect.y = (int32_t)vp.y;
+				rect.width = (int32_t)vp.width;
+				rect.height = (int32_t)vp.height;
+				RHIClearValue depth_clear = { vec4(0, 0, 0, 0), 0.0f, 0 };
+				cb->ClearAttachments(RHIImageAspectFlags::kDepth, 0, depth_clear, &rect, 1);
+				i++;
+				continue;
+			}
+
+			// pre-pass can not cross ClearZ, so it is done for each run of draws between them
+			if (b_depth_prepass && i >= prepass_end) {
+				prepass_end = i;
+				while (prepass_end < num_draw_calls &&
+					   kSurfaceShaderClearDepth != g_draw_calls[prepass_end].surface_shader) {
+					++prepass_end;
+				}
+				const bool b_timed = g_gpu_timer && g_gpu_timer->BeginSpan(cb, g_curFBIdx);
+				ue_record_depth_prepass(cb, i, prepass_end, bound_vb, bound_viewport_idx);
+				if (b_timed) {
+					g_gpu_timer->EndSpan(cb, g_curFBIdx);
+				}
+			}
+
+			// following draws which only differ in geometry are submitted without rebinding state
+			const int bucket_size = get_draw_bucket_size(i);
+
+			IRHIBuffer* dc_vb = dc.b_static_geom ? g_ue_world_cache->vb->device_buf_
+												 : g_ue_geom->vb[g_curFBIdx]->device_buf_;
+			if (dc_vb != bound_vb) {
+				bound_vb = dc_vb;
+				cb->BindVertexBuffers(&bound_vb, 0, 1);
+			}
 
 			//TODO: make this key where we fill drawcall struct?
-			uint32_t key = make_key(dc.surface_shader, dc.pipeline_blend, dc.b_depth_write, dc.b_alpha_test);
+			const bool b_two_phase = b_two_phase_masked && ue_is_two_phase_masked_draw(dc);
+			uint32_t key;
+			IRHIGraphicsPipeline* masked_depth_pipeline = nullptr;
+			if (b_two_phase) {
+				const SurfaceShader depth_shader = kSurfaceShaderGouraud == dc.surface_shader
+													   ? kSurfaceShaderMaskedDepthGouraud
+													   : kSurfaceShaderMaskedDepthComplex;
+				const uint32_t depth_key =
+					make_key(depth_shader, kPipeBlendNo, "DEPTH_WRITE", "ALPHA_TEST");
+				assert(g_ue_pipelines.count(depth_key));
+				masked_depth_pipeline = g_ue_pipelines[depth_key];
+				key = make_key(dc.surface_shader, kPipeBlendNo, "DEPTH_WRITE", "ALPHA_TEST",
+							   "DEPTH_TEST", "DEPTH_EQUAL");
+			} else {
+				key = make_key(dc.surface_shader, dc.pipeline_blend, dc.b_depth_write,
+							   dc.b_alpha_test, dc.b_depth_test,
+							   b_depth_prepass && ue_is_depth_prepass_draw(dc));
+			}
 			assert(g_ue_pipelines.count(key));
 			IRHIGraphicsPipeline* pipeline = g_ue_pipelines[key];
-			cb->BindPipeline(RHIPipelineBindPoint::kGraphics, pipeline);
-			cb->SetViewport(&dc.viewport, 1);
+			// both phases have the same layout, so descriptor sets stay bound in between
+			cb->BindPipeline(RHIPipelineBindPoint::kGraphics,
+							 masked_depth_pipeline ? masked_depth_pipeline : pipeline);
+			if (dc.viewport_idx != bound_viewport_idx) {
+				cb->SetViewport(&g_frame_viewports[dc.viewport_idx], 1);
+				bound_viewport_idx = dc.viewport_idx;
+			}
 
 			if (dc.dset) {
 
-				const bool is_complex = dc.surface_shader == kSurfaceShaderComplex;
+				const bool is_complex = kGeomStreamComplex == get_geom_stream(dc.surface_shader);
 
-				if(is_complex) {
-					cb->BindIndexBuffer(g_ue_complex_ib[g_curFBIdx]->device_buf_, 0, RHIIndexType::kUint32);
-					cb->BindVertexBuffers(&g_ue_complex_vb[g_curFBIdx]->device_buf_, 0, 1);
-				} else {
-					cb->BindIndexBuffer(g_ue_gouraud_ib[g_curFBIdx]->device_buf_, 0, RHIIndexType::kUint32);
-					cb->BindVertexBuffers(&g_ue_gouraud_vb[g_curFBIdx]->device_buf_, 0, 1);
-				}
-
-				RHIDescriptorWriteDesc desc_write_desc[5];
+				RHIDescriptorWriteDesc desc_write_desc[7];
 				RHIDescriptorWriteDescBuilder builder(desc_write_desc, countof(desc_write_desc));
 				// TODO: move g_ue_per_frame_uniforms out of "for" loop
-				builder.add(g_draw_calls[i].dset, 0, g_test_sampler,
-							RHIImageLayout::kShaderReadOnlyOptimal, dc.diffuse);
+				// lines and points are not textured
+				if (dc.diffuse) {
+					builder.add(g_draw_calls[i].dset, 0, g_test_sampler,
+								RHIImageLayout::kShaderReadOnlyOptimal, dc.diffuse);
+				}
 				if (dc.lightmap) {
 					builder.add(g_draw_calls[i].dset, 1, g_test_sampler,
 								RHIImageLayout::kShaderReadOnlyOptimal, dc.lightmap);
@@ -1762,6 +3827,16 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 				// TODO: have a separate set for this to not setup per draw call
 				builder.add(g_draw_calls[i].dset, is_complex ? 4 : 1, g_ue_per_frame_uniforms[g_curFBIdx], 0,
 							sizeof(UEPerFrameUniformBuf));
+				// complex shaders declare paletted diffuse whether draw uses it or not
+				if (is_complex) {
+					const IRHIImageView* palettes = g_texCachePaletted->getPaletteView();
+					builder.add(g_draw_calls[i].dset, 6, g_point_sampler,
+								RHIImageLayout::kShaderReadOnlyOptimal,
+								dc.diffuse_index ? dc.diffuse_index : g_tex_dummy_index_view);
+					builder.add(g_draw_calls[i].dset, 7, g_point_sampler,
+								RHIImageLayout::kShaderReadOnlyOptimal,
+								palettes ? palettes : g_tex_placeholder_view);
+				}
 				dev->UpdateDescriptorSet(desc_write_desc, builder.cur_index);
 
 				if (is_complex) {
@@ -1777,11 +3852,12 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 				}
 			}
 
-			if (dc.num_indices) {
-				cb->DrawIndexed(dc.num_indices, 1, dc.ib_offset, 0, 0);
-			} else {
-				cb->Draw(dc.num_vertices, 1, dc.ib_offset, 0);
+			ue_draw_bucket(cb, i, bucket_size, b_multi_draw);
+			if (masked_depth_pipeline) {
+				cb->BindPipeline(RHIPipelineBindPoint::kGraphics, pipeline);
+				ue_draw_bucket(cb, i, bucket_size, b_multi_draw);
 			}
+			i += bucket_size;
 		}
 	}
 #if 0
@@ -1825,6 +3901,9 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 #endif
 
 	cb->EndRenderPass(g_main_pass, cur_fb);
+	if (g_gpu_timer) {
+		g_gpu_timer->EndFrame(cb, g_curFBIdx);
+	}
 	cb->End();
 	dev->Submit(cb, RHIQueueType::kGraphics);
 
@@ -1838,44 +3917,56 @@ void UVulkanRenderDevice::Unlock(UBOOL Blit)
 		log_error("EndFrame failed\n");
 	}
 
-	g_ue_complex_vb_size[g_curFBIdx] = 0;
-	g_ue_complex_ib_size[g_curFBIdx] = 0;
+	g_ue_geom->reset(g_curFBIdx);
+
 	g_ue_complex_dsets_reserved[g_curFBIdx] = 0;
+	if (g_ue_tex_expander) {
+		g_ue_tex_expander->EndFrame(g_curFBIdx);
+	}
 	g_ue_complex_vs_ub->size[g_curFBIdx] = 0;
 
-	g_ue_gouraud_vb_size[g_curFBIdx] = 0;
-	g_ue_gouraud_ib_size[g_curFBIdx] = 0;
 	g_ue_gouraud_dsets_reserved[g_curFBIdx] = 0;
 	g_ue_gouraud_vs_ub->size[g_curFBIdx] = 0;
 
 	g_draw_calls.resize(0);
+	ue_reset_frame_viewports();
 
 	sanity_lock_cnt--;
 }
 
 
-const IRHIImageView* GetCachedTexture(struct FTextureInfo *Texture, unsigned long PolyFlags, class IRHIDevice *dev, bool b_detail) {
+static const IRHIImageView* ue_get_cached_texture(TextureCache* cache, struct FTextureInfo *Texture,
+												  unsigned long PolyFlags, class IRHIDevice *dev,
+												  bool b_detail) {
 
 	const IRHIImageView* rhi_texture = nullptr;
-	if (!g_texCache->isCached(Texture->CacheID)) {
+	if (!cache->isCached(Texture->CacheID)) {
 		TextureUploadTask* t;
-		g_texCache->cache(Texture, PolyFlags, dev, &t);
-		g_tex_upload_tasks.push_back(t);
-		rhi_texture = t->img_view;
+		cache->cache(Texture, PolyFlags, dev, &t);
+		if (t->state == TextureUploadTask::kConverting) {
+			// queued by TextureCache::collectConverted once ready
+			rhi_texture = g_tex_placeholder_view;
+		} else {
+			g_tex_upload_tasks.push_back(t);
+			rhi_texture = t->img_view;
+		}
+	} else if (cache->isPending(Texture->CacheID)) {
+		rhi_texture = g_tex_placeholder_view;
 	} else {
 		if (Texture->bRealtimeChanged) {
 			TextureUploadTask* t;
-			g_texCache->update(Texture, PolyFlags, dev, &t);
-			g_tex_upload_tasks.push_back(t);
+			if (cache->update(Texture, PolyFlags, dev, &t)) {
+				g_tex_upload_tasks.push_back(t);
+			}
 		}
 		//Mask bit changed. Static texture, so must be deleted and recreated.
-		else if (!b_detail && (PolyFlags & PF_Masked) != 0 && !g_texCache->isMasked(Texture->CacheID))
+		else if (!b_detail && (PolyFlags & PF_Masked) != 0 && !cache->isMasked(Texture->CacheID))
 		{
 			//assert(!"Handle this");
 			//delete & recache
 		}
 			
-		rhi_texture = g_texCache->get(Texture->CacheID);
+		rhi_texture = cache->get(Texture->CacheID);
 	}
 	
 	//if (Texture->bRealtimeChanged) {
@@ -1885,6 +3976,40 @@ const IRHIImageView* GetCachedTexture(struct FTextureInfo *Texture, unsigned lon
 	return rhi_texture;
 }
 
+const IRHIImageView* GetCachedTexture(struct FTextureInfo *Texture, unsigned long PolyFlags, class IRHIDevice *dev, bool b_detail) {
+	return ue_get_cached_texture(g_texCache, Texture, PolyFlags, dev, b_detail);
+}
+
+// World diffuse texture which is drawn from g_texCachePaletted. Masked surfaces need RGBA alpha for
+// alpha test and depth pass, surface cache builds sample RGBA diffuse.
+bool UVulkanRenderDevice::IsPalettedDiffuse(const FTextureInfo& Texture, DWORD PolyFlags) const {
+	return options.palettedTextures && !options.surfaceCache && Texture.Format == TEXF_P8 &&
+		   !(PolyFlags & PF_Masked);
+}
+
+// Returns true if every vertex of the facet is beyond detail fade distance. Polygons are planar so Z
+// inside of them never gets smaller than the one of the nearest vertex.
+static bool ue_facet_beyond_detail_distance(const FSurfaceFacet& Facet) {
+	for (const FSavedPoly* Poly = Facet.Polys; Poly; Poly = Poly->Next) {
+		for (INT i = 0; i < Poly->NumPts; i++) {
+			if (Poly->Pts[i]->Point.Z < gUEDetailFadeDistance)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Returns true if no vertex of the facet is farther than distance, neither is any point inside then
+static bool ue_facet_within_distance(const FSurfaceFacet& Facet, float distance) {
+	for (const FSavedPoly* Poly = Facet.Polys; Poly; Poly = Poly->Next) {
+		for (INT i = 0; i < Poly->NumPts; i++) {
+			if (Poly->Pts[i]->Point.Z > distance)
+				return false;
+		}
+	}
+	return true;
+}
+
 /**
 Complex surfaces are used for map geometry. They consist of facets which in turn consist of polys (triangle fans).
 \param Frame The scene. See SetSceneNode().
@@ -1912,16 +4037,36 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 	const IRHIImageView *rhi_lightmap = nullptr;
 	const IRHIImageView *rhi_detail = nullptr;
 	const IRHIImageView *rhi_fog = nullptr;
-	const IRHIImageView *rhi_diffuse =
-		GetCachedTexture(Surface.Texture, Surface.PolyFlags, g_vulkan_device, false);
+	const IRHIImageView *rhi_diffuse = nullptr;
+	const IRHIImageView *rhi_diffuse_index = nullptr;
+	int palette_row = -1;
+
+	const bool b_paletted = IsPalettedDiffuse(*Surface.Texture, Surface.PolyFlags);
+	if (b_paletted) {
+		rhi_diffuse = ue_get_cached_texture(g_texCachePaletted, Surface.Texture, Surface.PolyFlags,
+											g_vulkan_device, false);
+		// no row if palette table is full, texture is RGBA then
+		palette_row = g_texCachePaletted->getPaletteRow(Surface.Texture->CacheID);
+		if (palette_row >= 0) {
+			rhi_diffuse_index = rhi_diffuse;
+			rhi_diffuse = g_tex_placeholder_view;
+		}
+	} else {
+		rhi_diffuse = GetCachedTexture(Surface.Texture, Surface.PolyFlags, g_vulkan_device, false);
+	}
 
 	if (Surface.MacroTexture) {
 		rhi_macro = GetCachedTexture(Surface.MacroTexture, Surface.PolyFlags, g_vulkan_device, false);
 		check(rhi_macro);
 	}
 
+	const LightmapAtlasTile* lm_tile = nullptr;
 	if (Surface.LightMap) {
-		rhi_lightmap = GetCachedTexture(Surface.LightMap, Surface.PolyFlags, g_vulkan_device, false);
+		if (options.lightmapAtlas && g_ue_lightmap_atlas) {
+			lm_tile = g_ue_lightmap_atlas->get(*Surface.LightMap, g_curFBIdx);
+		}
+		rhi_lightmap = lm_tile ? g_ue_lightmap_atlas->page_views[lm_tile->page]
+							   : GetCachedTexture(Surface.LightMap, Surface.PolyFlags, g_vulkan_device, false);
 		check(rhi_lightmap);
 	}
 
@@ -1932,10 +4077,10 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 
 	//See if detail texture should be drawn
 	//FogMap and DetailTexture are mutually exclusive effects
-	// TODO: can add early rejection of detail texture if all vertices in draw call are too far, but probably not necessary
 	bool drawDetailTexture = false;
 	if ((DetailTextures != 0) && Surface.DetailTexture && !Surface.FogMap) {
-		drawDetailTexture = true;
+		drawDetailTexture = m_detailTextureColor4ub != gUENeutralDetailTexColor ||
+							!ue_facet_beyond_detail_distance(Facet);
 	}
 
 	if (drawDetailTexture && Surface.DetailTexture) {
@@ -1955,8 +4100,9 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 
 	uint32_t Flags = Surface.PolyFlags;
 
-	uint32_t& cur_vb_idx = g_ue_complex_vb_size[g_curFBIdx];
-	uint32_t& cur_ib_idx = g_ue_complex_ib_size[g_curFBIdx];
+	GeometryStream& geom = g_ue_geom->streams[kGeomStreamComplex];
+	uint32_t& cur_vb_idx = geom.vb_size[g_curFBIdx];
+	uint32_t& cur_ib_idx = geom.ib_size[g_curFBIdx];
 
 	
 	uint32_t& cur_vs_data_idx = g_ue_complex_vs_ub->size[g_curFBIdx];
@@ -1968,6 +4114,9 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 	vs_uniforms[cur_vs_data_idx].YAxis_VDot = vec4(*(vec3 *)&Facet.MapCoords.YAxis.X, VDot);
 	vs_uniforms[cur_vs_data_idx].Diffuse_PanXY_UVMult =
 		vec4(Surface.Texture->Pan.X, Surface.Texture->Pan.Y, UMult, VMult);
+	// per draw and not per frame, so depth pre-pass and shading pass always agree on it
+	vs_uniforms[cur_vs_data_idx].proj = g_current_projection;
+	vs_uniforms[cur_vs_data_idx].Palette = vec4((float)palette_row, 0, 0, 0);
 
 	if (rhi_macro) {
 		float UScale = Surface.MacroTexture->UScale;
@@ -1992,6 +4141,10 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		LM_VMult = 1.0f / (VScale * VSize);
 		vs_uniforms[cur_vs_data_idx].Lightmap_PanXY_UVMult =
 			vec4(Surface.LightMap->Pan.X, Surface.LightMap->Pan.Y, LM_UMult, LM_VMult);
+		if (lm_tile) {
+			g_ue_lightmap_atlas->get_lightmap_params(*lm_tile, *Surface.LightMap,
+													 &vs_uniforms[cur_vs_data_idx].Lightmap_PanXY_UVMult);
+		}
 		vs_uniforms[cur_vs_data_idx].HasLightmap_UVScale = vec4(1, UScale, VScale, 0);
 	} else {
 		vs_uniforms[cur_vs_data_idx].HasLightmap_UVScale.x = 0;
@@ -2012,12 +4165,46 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		vs_uniforms[cur_vs_data_idx].HasDetail_UVScale.x = 0;
 	}
 
+	// Only diffuse x lightmap is cached, masked ones need diffuse alpha for alpha test. Cached
+	// surface samples its tile through lightmap coordinates and lightmap binding. Tiles have no mips,
+	// so surface is cached only up to the distance where its diffuse texel gets smaller than a pixel
+	// (m_RFX2 is the pixel size at Z = 1), farther ones use mipmapped diffuse texture.
+	const SurfaceCacheTile* cache_tile = nullptr;
+	if (options.surfaceCache && g_ue_surface_cache && rhi_lightmap && !rhi_detail && !rhi_fog &&
+		!rhi_macro && !(Surface.PolyFlags & PF_Masked) && rhi_diffuse != g_tex_placeholder_view &&
+		ue_facet_within_distance(Facet, min(Surface.Texture->UScale, Surface.Texture->VScale) / m_RFX2)) {
+		const vec4 lm_xform = lm_tile ? g_ue_lightmap_atlas->get_xform(*lm_tile, *Surface.LightMap)
+									  : vec4(0, 0, 1, 1);
+		cache_tile = g_ue_surface_cache->get(Surface, rhi_diffuse, rhi_lightmap, lm_xform, g_curFBIdx);
+	}
+	if (cache_tile) {
+		g_ue_surface_cache->get_lightmap_params(*cache_tile, *Surface.LightMap,
+												&vs_uniforms[cur_vs_data_idx].Lightmap_PanXY_UVMult);
+		rhi_lightmap = g_ue_surface_cache->page_views[cache_tile->page];
+		rhi_diffuse = nullptr;
+	}
+
+	// cached world geometry is in world space, VS moves it to the view space UE has given us
+	const bool b_world_space = nullptr != g_ue_world_cache;
+	if (b_world_space) {
+		const FCoords& C = Frame->Coords;
+		vs_uniforms[cur_vs_data_idx].world_to_view =
+			mat4(C.XAxis.X, C.XAxis.Y, C.XAxis.Z, -(C.Origin | C.XAxis),
+				 C.YAxis.X, C.YAxis.Y, C.YAxis.Z, -(C.Origin | C.YAxis),
+				 C.ZAxis.X, C.ZAxis.Y, C.ZAxis.Z, -(C.Origin | C.ZAxis),
+				 0, 0, 0, 1);
+	} else {
+		vs_uniforms[cur_vs_data_idx].world_to_view = mat4::identity();
+	}
+	const uint64_t surface_key =
+		ue_hash_u32(ue_hash_u32(Surface.Texture->CacheID, (uint32_t)(Surface.Texture->CacheID >> 32)),
+					Surface.PolyFlags);
+
 	cur_vs_data_idx++;
 
 	//Draw each polygon
 	for(FSavedPoly* Poly=Facet.Polys; Poly; Poly=Poly->Next )
 	{
-		const uint32_t vb_offset = cur_vb_idx;
 		const uint32_t ib_offset = cur_ib_idx;
 		
 		if(Poly->NumPts < 3) {
@@ -2025,35 +4212,54 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 			continue;
 		}
 
-		UEVertexComplex* VB = (UEVertexComplex*)g_ue_complex_vb[g_curFBIdx]->getMappedPtr();
-		uint32_t* IB = (uint32_t*)g_ue_complex_ib[g_curFBIdx]->getMappedPtr();
+		UEVertexComplex* VB = g_ue_geom->vertices<UEVertexComplex>(kGeomStreamComplex, g_curFBIdx);
+		uint32_t* IB = g_ue_geom->indices(kGeomStreamComplex, g_curFBIdx);
 
 		const int32_t num_verts = Poly->NumPts;
-		const int32_t num_indices_for_poly_fan = (num_verts - 2) * 3;
-
-		assert(cur_ib_idx + num_indices_for_poly_fan < gUENumIndices);
-		assert(cur_vb_idx + Poly->NumPts < gUENumVert);
+		const int32_t num_indices_for_poly_fan = ue_fan_index_count(g_fan_mode, num_verts);
+		const bool b_split = ue_fan_needs_split(g_fan_mode, num_verts);
+		const int32_t num_written_verts = b_split ? ue_split_fan_vertex_count(num_verts) : num_verts;
+
+		assert(cur_ib_idx + num_indices_for_poly_fan < geom.max_indices);
+		assert(cur_vb_idx + num_written_verts < geom.max_vertices);
+
+		// first vertex of the polygon either in StaticWorldCache or in per frame arena
+		uint32_t first_vert = cur_vb_idx;
+		bool b_static_geom = false;
+		// Engine only passes clipped view space points, so telling cached polygon from a moved or
+		// differently clipped one needs each of them in world space. Transformed points are
+		// reused if polygon is streamed.
+		vec3 world_pos[gUEMaxCachedPolyVerts];
+		const bool b_cacheable = b_world_space && num_verts <= gUEMaxCachedPolyVerts;
+		if (b_cacheable) {
+			for (INT i = 0; i < num_verts; i++) {
+				FVector P = Poly->Pts[i]->Point.TransformPointBy(Frame->Uncoords);
+				world_pos[i] = *(vec3*)&P.X;
+			}
+			const StaticPolyEntry* entry = g_ue_world_cache->get(surface_key, world_pos, num_verts);
+			if (entry) {
+				first_vert = entry->first_vertex;
+				b_static_geom = true;
+			}
+		}
 
 		// Generate fan indices
-		for (int i = 1; i < num_verts - 1; i++) {
-			IB[cur_ib_idx++] = cur_vb_idx ; // Center point
-			IB[cur_ib_idx++] = cur_vb_idx + i;
-			IB[cur_ib_idx++] = cur_vb_idx + i + 1;
-		}
+		cur_ib_idx += ue_emit_fan_indices(g_fan_mode, IB + cur_ib_idx, first_vert, num_verts);
 
-		// Generate fan vertices 
-		for (INT i = 0; i < num_verts; i++)
+		// Generate fan vertices, split fans are never cacheable
+		for (INT i = 0; i < num_written_verts && !b_static_geom; i++)
 		{
 			UEVertexComplex* v = VB + cur_vb_idx++;
+			const INT src = b_split ? ue_split_fan_src_vertex(i) : i;
 			
-			// TODO: this can be doen in VS!
-			FLOAT U = Facet.MapCoords.XAxis | Poly->Pts[i]->Point;
-			FLOAT V = Facet.MapCoords.YAxis | Poly->Pts[i]->Point;
-			FLOAT UCoord = U-UDot;
-			FLOAT VCoord = V-VDot;
-
-			//v->Flags = Flags;
-			v->Pos = *(vec3*)&Poly->Pts[i]->Point.X; //Position
+			if (b_cacheable) {
+				v->Pos = world_pos[i];
+			} else if (b_world_space) {
+				FVector P = Poly->Pts[src]->Point.TransformPointBy(Frame->Uncoords);
+				v->Pos = *(vec3*)&P.X;
+			} else {
+				v->Pos = *(vec3*)&Poly->Pts[src]->Point.X; //Position
+			}
 		}
 
 		if(!(Flags & (PF_Translucent|PF_Modulated))) //If none of these flags, occlude (opengl renderer)
@@ -2072,8 +4278,7 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		dc.pipeline_blend = select_blend(Flags);
 		dc.b_depth_write = select_depth_write(Flags);
 		//dc.b_depth_clear = 0;
-		// TODO: if masked we should use DepthEqual because triangles are drawn on top of something
-		// which has been already drawn (see D3D9 renderer)
+		// masked ones are drawn as depth and then colour with DepthEqual, see ue_is_two_phase_masked_draw()
 		dc.b_alpha_test = Flags & PF_Masked;
 
 		// either alpha test or blend
@@ -2084,11 +4289,19 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		if(dc.b_alpha_test && kPipeBlendNo != dc.pipeline_blend) {
 			log_info("alpha test + alpha blend");
 		}
-		dc.surface_shader = kSurfaceShaderComplex;
-		dc.vb_offset = vb_offset;
-		dc.num_vertices = cur_vb_idx - vb_offset;
+		// alpha tested variant still has detail branch, it is uniform so costs little there
+		if (cache_tile) {
+			dc.surface_shader = kSurfaceShaderComplexCached;
+		} else {
+			dc.surface_shader = (rhi_detail || dc.b_alpha_test) ? kSurfaceShaderComplex
+																: kSurfaceShaderComplexNoDetail;
+		}
+		dc.b_depth_test = true;
+		dc.b_static_geom = b_static_geom;
+		dc.vb_offset = first_vert;
+		dc.num_vertices = b_split ? gUEMaxFanVerts : num_verts;
 		dc.ib_offset = ib_offset;
-		dc.num_indices = cur_ib_idx - ib_offset;
+		dc.num_indices = ue_fan_draw_index_count(g_fan_mode, dc.num_vertices, cur_ib_idx - ib_offset);
 		// should always equal to dc index in g_draw_calls array
 		// (however we have ClearZ which also adds draw call, so indices may be shifted, so let's
 		// have it for now)
@@ -2098,7 +4311,8 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		assert((0==rhi_detail && 0==rhi_fog) || (!!rhi_fog ^ !!rhi_detail));
 		dc.detail = rhi_detail ? rhi_detail : rhi_fog;
 		dc.macro = rhi_macro;
-		dc.viewport = g_current_viewport;
+		dc.diffuse_index = rhi_diffuse_index;
+		dc.viewport_idx = g_current_viewport_idx;
 		// TODO: rework this to a simple free list of dsets
 		if (g_ue_complex_dsets[g_curFBIdx].size() == (size_t)g_ue_complex_dsets_reserved[g_curFBIdx]) {
 			g_ue_complex_dsets[g_curFBIdx].push_back(
@@ -2108,11 +4322,51 @@ void UVulkanRenderDevice::DrawComplexSurface(FSceneNode* Frame, FSurfaceInfo& Su
 		g_ue_complex_dsets_reserved[g_curFBIdx]++;
 		g_draw_calls.emplace_back(dc);
 
+		// rest of a split fan shares UB slot and descriptor set, it is submitted in the same bucket
+		for (int32_t v = gUEMaxFanVerts; b_split && v < num_written_verts; v += gUEMaxFanVerts) {
+			dc.vb_offset = first_vert + v;
+			dc.num_vertices = min(num_written_verts - v, (int32_t)gUEMaxFanVerts);
+			dc.num_indices = ue_fan_draw_index_count(g_fan_mode, dc.num_vertices, 0);
+			g_draw_calls.emplace_back(dc);
+		}
+
 	//	log_info("i: %d flags: %x depth write: %d\n", idx, Flags, dc.b_depth_write);
 		//log_info("Complex\n");
 	}
 }
 
+// Returns last recorded draw call if gouraud polygon with given state can be appended to it (same
+// texture, pipeline, viewport and projection) or nullptr if a new draw call has to be started.
+// Appended geometry goes right after the batch in VB/IB because nothing else writes to gouraud
+// buffers in between.
+static ComplexSurfaceDrawCall* find_open_gouraud_batch(const IRHIImageView* diffuse,
+													   PipelineBlend pipeline_blend,
+													   bool b_depth_write, bool b_alpha_test) {
+	if (g_draw_calls.empty())
+		return nullptr;
+
+	ComplexSurfaceDrawCall& dc = g_draw_calls.back();
+	if (dc.surface_shader != kSurfaceShaderGouraud || dc.diffuse != diffuse ||
+		dc.pipeline_blend != pipeline_blend || dc.b_depth_write != b_depth_write ||
+		dc.b_alpha_test != b_alpha_test) {
+		return nullptr;
+	}
+
+	if (dc.viewport_idx != g_current_viewport_idx)
+		return nullptr;
+
+	BufferView<UEPerDrawCallGouraudVsData> vs_uniforms(
+		g_ue_gouraud_vs_ub->buf[g_curFBIdx]->getMappedPtr(), g_ue_gouraud_vs_ub->el_size,
+		g_ue_gouraud_vs_ub->num_el);
+	if (0 != memcmp(&vs_uniforms[dc.vs_ub_idx].proj, &g_current_projection, sizeof(mat4)))
+		return nullptr;
+
+	assert(kFanModeTable == g_fan_mode ||
+		   dc.ib_offset + dc.num_indices == g_ue_geom->streams[kGeomStreamGouraud].ib_size[g_curFBIdx]);
+	assert(dc.vb_offset + dc.num_vertices == g_ue_geom->streams[kGeomStreamGouraud].vb_size[g_curFBIdx]);
+	return &dc;
+}
+
 /**
 Gouraud shaded polygons are used for 3D models and surprisingly decals and shadows. 
 They are sent with a call of this function per triangle fan, worldview transformed and lit. They do have normals and texture coordinates (no panning).
@@ -2175,47 +4429,61 @@ void UVulkanRenderDevice::DrawGouraudPolygon(FSceneNode *Frame, FTextureInfo &In
 	const float UMult = 1.0f / (Info.UScale * Info.USize);
 	const float VMult = 1.0f / (Info.VScale * Info.VSize);
 
+	const PipelineBlend pipeline_blend = select_blend(PolyFlags);
+	const bool b_depth_write = select_depth_write(PolyFlags);
+	// masked ones are drawn as depth and then colour with DepthEqual, see ue_is_two_phase_masked_draw()
+	const bool b_alpha_test = !!(PolyFlags & PF_Masked);
+
+	// either alpha test or blend
+	assert((!b_alpha_test && kPipeBlendNo == pipeline_blend) ||
+		   (b_alpha_test ^ (!!pipeline_blend)));
+
+	// meshes come one fan at a time, so try to append to the previous draw call first
+	ComplexSurfaceDrawCall* batch =
+		find_open_gouraud_batch(rhi_diffuse, pipeline_blend, b_depth_write, b_alpha_test);
+
 	uint32_t& cur_vs_data_idx = g_ue_gouraud_vs_ub->size[g_curFBIdx];
-	BufferView<UEPerDrawCallGouraudVsData> vs_uniforms(
-		g_ue_gouraud_vs_ub->buf[g_curFBIdx]->getMappedPtr(), g_ue_gouraud_vs_ub->el_size,
-		g_ue_gouraud_vs_ub->num_el);
-	vs_uniforms[cur_vs_data_idx++].proj = g_current_projection;
+	if (!batch) {
+		BufferView<UEPerDrawCallGouraudVsData> vs_uniforms(
+			g_ue_gouraud_vs_ub->buf[g_curFBIdx]->getMappedPtr(), g_ue_gouraud_vs_ub->el_size,
+			g_ue_gouraud_vs_ub->num_el);
+		vs_uniforms[cur_vs_data_idx++].proj = g_current_projection;
+	}
 
-	uint32_t& cur_vb_idx = g_ue_gouraud_vb_size[g_curFBIdx];
-	uint32_t& cur_ib_idx = g_ue_gouraud_ib_size[g_curFBIdx];
+	GeometryStream& geom = g_ue_geom->streams[kGeomStreamGouraud];
+	uint32_t& cur_vb_idx = geom.vb_size[g_curFBIdx];
+	uint32_t& cur_ib_idx = geom.ib_size[g_curFBIdx];
 	const uint32_t vb_offset = cur_vb_idx;
 	const uint32_t ib_offset = cur_ib_idx;
 
-	UEVertexGouraud* VB = (UEVertexGouraud*)g_ue_gouraud_vb[g_curFBIdx]->getMappedPtr();
-	uint32_t* IB = (uint32_t*)g_ue_gouraud_ib[g_curFBIdx]->getMappedPtr();
+	UEVertexGouraud* VB = g_ue_geom->vertices<UEVertexGouraud>(kGeomStreamGouraud, g_curFBIdx);
+	uint32_t* IB = g_ue_geom->indices(kGeomStreamGouraud, g_curFBIdx);
 
 	const int32_t num_verts = NumPts;
-	const int32_t num_indices_for_poly_fan = (num_verts - 2) * 3;
+	const int32_t num_indices_for_poly_fan = ue_fan_index_count(g_fan_mode, num_verts);
+	const bool b_split = ue_fan_needs_split(g_fan_mode, num_verts);
+	const int32_t num_written_verts = b_split ? ue_split_fan_vertex_count(num_verts) : num_verts;
 
-	assert(cur_ib_idx + num_indices_for_poly_fan < gUENumIndices);
-	assert(cur_vb_idx + NumPts < gUENumVert);
+	assert(cur_ib_idx + num_indices_for_poly_fan < geom.max_indices);
+	assert(cur_vb_idx + num_written_verts < geom.max_vertices);
 
 	// Generate fan indices
-	for (int i = 1; i < num_verts - 1; i++) {
-		IB[cur_ib_idx++] = cur_vb_idx; // Center point
-		IB[cur_ib_idx++] = cur_vb_idx + i;
-		IB[cur_ib_idx++] = cur_vb_idx + i + 1;
-	}
+	cur_ib_idx += ue_emit_fan_indices(g_fan_mode, IB + cur_ib_idx, cur_vb_idx, num_verts);
 
 	// Generate fan vertices
-	for (INT i = 0; i < num_verts; i++) {
+	for (INT i = 0; i < num_written_verts; i++) {
 		UEVertexGouraud* v = VB + cur_vb_idx++;
-		v->Pos = *(vec3 *)&Pts[i]->Point.X; // Position
-		v->TexCoord.x = Pts[i]->U * UMult;
-		v->TexCoord.y = Pts[i]->V * VMult;
-		v->TexCoord.z = (float)g_idx;
+		const FTransTexture* P = Pts[b_split ? ue_split_fan_src_vertex(i) : i];
+		v->Pos = *(vec3 *)&P->Point.X; // Position
+		v->TexCoord.x = P->U * UMult;
+		v->TexCoord.y = P->V * VMult;
 		
 		if(requestedColorFlags & FogFlags) {
-			FLOAT f255_Times_One_Minus_FogW = 255.0f * (1.0f - Pts[i]->Fog.W);
-			v->Color = FPlaneTo_BGRScaled_A255(&Pts[i]->Light, f255_Times_One_Minus_FogW);
-			v->FogColor = FPlaneTo_BGR_A0(&Pts[i]->Fog);
+			FLOAT f255_Times_One_Minus_FogW = 255.0f * (1.0f - P->Fog.W);
+			v->Color = FPlaneTo_BGRScaled_A255(&P->Light, f255_Times_One_Minus_FogW);
+			v->FogColor = FPlaneTo_BGR_A0(&P->Fog);
 		} else if(requestedColorFlags & ColorFlags) {
-			v->Color = FPlaneTo_BGR_A0(&Pts[i]->Light);
+			v->Color = FPlaneTo_BGR_A0(&P->Light);
 			v->FogColor = 0;
 		} else {
 			v->Color = 0xFFFFFFFF;
@@ -2223,29 +4491,45 @@ void UVulkanRenderDevice::DrawGouraudPolygon(FSceneNode *Frame, FTextureInfo &In
 		}
 	}
 
+	if (batch) {
+		if (kFanModeTable == g_fan_mode) {
+			// every fan (or piece of a split one) needs its own vertex offset, so add records sharing
+			// batch's UB slot and descriptor set, they will be submitted in the same bucket
+			ComplexSurfaceDrawCall dc = *batch;
+			for (int32_t v = 0; v < num_written_verts; v += gUEMaxFanVerts) {
+				dc.vb_offset = vb_offset + v;
+				dc.num_vertices = min(num_written_verts - v, (int32_t)gUEMaxFanVerts);
+				dc.ib_offset = ib_offset;
+				dc.num_indices = ue_fan_draw_index_count(g_fan_mode, dc.num_vertices, 0);
+				g_draw_calls.emplace_back(dc);
+			}
+		} else {
+			batch->num_vertices += cur_vb_idx - vb_offset;
+			batch->num_indices += cur_ib_idx - ib_offset;
+		}
+		g_idx++;
+		return;
+	}
+
 	ComplexSurfaceDrawCall dc;
-	dc.pipeline_blend = select_blend(PolyFlags);
-	dc.b_depth_write = select_depth_write(PolyFlags);
+	dc.pipeline_blend = pipeline_blend;
+	dc.b_depth_write = b_depth_write;
 	//dc.b_depth_clear = 0;
-	// TODO: if masked we should use DepthEqual because triangles are drawn on top of something
-	// which has been already drawn (see D3D9 renderer)
-	dc.b_alpha_test = PolyFlags & PF_Masked;
-
-	// either alpha test or blend
-	assert((!dc.b_alpha_test && kPipeBlendNo == dc.pipeline_blend) ||
-		   (dc.b_alpha_test ^ (!!dc.pipeline_blend)));
-
+	dc.b_alpha_test = b_alpha_test;
 	dc.surface_shader = kSurfaceShaderGouraud;
+	dc.b_depth_test = true;
+	dc.b_static_geom = false;
 	dc.vb_offset = vb_offset;
-	dc.num_vertices = cur_vb_idx - vb_offset;
+	dc.num_vertices = b_split ? gUEMaxFanVerts : cur_vb_idx - vb_offset;
 	dc.ib_offset = ib_offset;
-	dc.num_indices = cur_ib_idx - ib_offset;
+	dc.num_indices = ue_fan_draw_index_count(g_fan_mode, dc.num_vertices, cur_ib_idx - ib_offset);
 	dc.diffuse = rhi_diffuse;
 	dc.detail = nullptr;
 	dc.lightmap = nullptr;
 	dc.macro = nullptr;
+	dc.diffuse_index = nullptr;
 	dc.vs_ub_idx = cur_vs_data_idx-1;
-	dc.viewport = g_current_viewport;
+	dc.viewport_idx = g_current_viewport_idx;
 	// TODO: rework this to a simple free list of dsets
 	if (g_ue_gouraud_dsets[g_curFBIdx].size() == (size_t)g_ue_gouraud_dsets_reserved[g_curFBIdx]) {
 		g_ue_gouraud_dsets[g_curFBIdx].push_back(
@@ -2256,6 +4540,14 @@ void UVulkanRenderDevice::DrawGouraudPolygon(FSceneNode *Frame, FTextureInfo &In
 	//g_gouraud_draw_calls.emplace_back(dc);
 	g_draw_calls.emplace_back(dc);
 
+	// rest of a split fan, same as batched fans above
+	for (int32_t v = gUEMaxFanVerts; b_split && v < num_written_verts; v += gUEMaxFanVerts) {
+		dc.vb_offset = vb_offset + v;
+		dc.num_vertices = min(num_written_verts - v, (int32_t)gUEMaxFanVerts);
+		dc.num_indices = ue_fan_draw_index_count(g_fan_mode, dc.num_vertices, 0);
+		g_draw_calls.emplace_back(dc);
+	}
+
 	//log_info("i: %d flags: %x depth write: %d pipe_bled: %d \n", g_idx, PolyFlags, dc.b_depth_write, dc.pipeline_blend);
 	g_idx++;
 
@@ -2325,27 +4617,24 @@ void UVulkanRenderDevice::DrawTile(FSceneNode *Frame, FTextureInfo &Info, FLOAT
 		g_ue_gouraud_vs_ub->num_el);
 	vs_uniforms[cur_vs_data_idx++].proj = g_current_projection;
 
-	uint32_t& cur_vb_idx = g_ue_gouraud_vb_size[g_curFBIdx];
-	uint32_t& cur_ib_idx = g_ue_gouraud_ib_size[g_curFBIdx];
+	GeometryStream& geom = g_ue_geom->streams[kGeomStreamGouraud];
+	uint32_t& cur_vb_idx = geom.vb_size[g_curFBIdx];
+	uint32_t& cur_ib_idx = geom.ib_size[g_curFBIdx];
 	const uint32_t vb_offset = cur_vb_idx;
 	const uint32_t ib_offset = cur_ib_idx;
 
 	// TODO: can use special quad shader which will calculate texcoords from vertex_id % 4
-	UEVertexGouraud* VB = (UEVertexGouraud*)g_ue_gouraud_vb[g_curFBIdx]->getMappedPtr();
-	uint32_t* IB = (uint32_t*)g_ue_gouraud_ib[g_curFBIdx]->getMappedPtr();
+	UEVertexGouraud* VB = g_ue_geom->vertices<UEVertexGouraud>(kGeomStreamGouraud, g_curFBIdx);
+	uint32_t* IB = g_ue_geom->indices(kGeomStreamGouraud, g_curFBIdx);
 
 	const int32_t num_verts = 4;
-	const int32_t num_indices_for_poly_fan = (num_verts - 2) * 3;
+	const int32_t num_indices_for_poly_fan = ue_fan_index_count(g_fan_mode, num_verts);
 
-	assert(cur_ib_idx + num_indices_for_poly_fan < gUENumIndices);
-	assert(cur_vb_idx + num_verts < gUENumVert);
+	assert(cur_ib_idx + num_indices_for_poly_fan < geom.max_indices);
+	assert(cur_vb_idx + num_verts < geom.max_vertices);
 
 	// Generate fan indices
-	for (int i = 1; i < num_verts - 1; i++) {
-		IB[cur_ib_idx++] = cur_vb_idx; // Center point
-		IB[cur_ib_idx++] = cur_vb_idx + i;
-		IB[cur_ib_idx++] = cur_vb_idx + i + 1;
-	}
+	cur_ib_idx += ue_emit_fan_indices(g_fan_mode, IB + cur_ib_idx, cur_vb_idx, num_verts);
 
 	// Generate fan vertices
 	{
@@ -2354,17 +4643,10 @@ void UVulkanRenderDevice::DrawTile(FSceneNode *Frame, FTextureInfo &Info, FLOAT
 		UEVertexGouraud* v2 = VB + cur_vb_idx++;
 		UEVertexGouraud* v3 = VB + cur_vb_idx++;
 
-		v0->TexCoord.x = SU1;
-		v0->TexCoord.y = SV1;
-
-		v1->TexCoord.x = SU2;
-		v1->TexCoord.y = SV1;
-
-		v2->TexCoord.x = SU2;
-		v2->TexCoord.y = SV2;
-
-		v3->TexCoord.x = SU1;
-		v3->TexCoord.y = SV2;
+		v0->TexCoord = vec2(SU1, SV1);
+		v1->TexCoord = vec2(SU2, SV1);
+		v2->TexCoord = vec2(SU2, SV2);
+		v3->TexCoord = vec2(SU1, SV2);
 
 		v0->Pos.x = RPX1;
 		v0->Pos.y = RPY1;
@@ -2395,20 +4677,22 @@ void UVulkanRenderDevice::DrawTile(FSceneNode *Frame, FTextureInfo &Info, FLOAT
 	dc.pipeline_blend = select_blend(PolyFlags);
 	dc.b_depth_write = select_depth_write(PolyFlags);
 	//dc.b_depth_clear = 0;
-	// TODO: if masked we should use DepthEqual because triangles are drawn on top of something
-	// which has been already drawn (see D3D9 renderer)
+	// masked ones are drawn as depth and then colour with DepthEqual, see ue_is_two_phase_masked_draw()
 	dc.b_alpha_test = PolyFlags & PF_Masked;
 	dc.surface_shader = kSurfaceShaderGouraud;
+	dc.b_depth_test = true;
+	dc.b_static_geom = false;
 	dc.vb_offset = vb_offset;
 	dc.num_vertices = cur_vb_idx - vb_offset;
 	dc.ib_offset = ib_offset;
-	dc.num_indices = cur_ib_idx - ib_offset;
+	dc.num_indices = ue_fan_draw_index_count(g_fan_mode, num_verts, cur_ib_idx - ib_offset);
 	dc.diffuse = rhi_diffuse;
 	dc.detail = nullptr;
 	dc.lightmap = nullptr;
 	dc.macro = nullptr;
+	dc.diffuse_index = nullptr;
 	dc.vs_ub_idx = cur_vs_data_idx-1;
-	dc.viewport = g_current_viewport;
+	dc.viewport_idx = g_current_viewport_idx;
 	// TODO: rework this to a simple free list of dsets
 	if (g_ue_gouraud_dsets[g_curFBIdx].size() == (size_t)g_ue_gouraud_dsets_reserved[g_curFBIdx]) {
 		g_ue_gouraud_dsets[g_curFBIdx].push_back(
@@ -2424,11 +4708,113 @@ void UVulkanRenderDevice::DrawTile(FSceneNode *Frame, FTextureInfo &Info, FLOAT
 	//log_info("DrawTile");
 
 }
+// Screen space point to view space, same as in DrawTile
+static vec3 ue_screen_to_view(const FSceneNode* Frame, float RFX2, float RFY2, FLOAT X, FLOAT Y,
+							  FLOAT Z) {
+	FLOAT RPX = RFX2 * (X - Frame->FX2);
+	FLOAT RPY = RFY2 * (Y - Frame->FY2);
+	if (!Frame->Viewport->IsOrtho()) {
+		RPX *= Z;
+		RPY *= Z;
+	}
+	return vec3(RPX, RPY, Z);
+}
+
+// Returns vertices for "count" new line or point vertices. Lines and points are appended to the
+// previous draw call when state is the same, so that editor wireframe (thousands of lines) ends up
+// in a few draw calls.
+static UEVertexLine* ue_alloc_line_vertices(SurfaceShader shader, DWORD LineFlags, uint32_t count) {
+	GeometryStream& geom = g_ue_geom->streams[kGeomStreamLine];
+	uint32_t& cur_vb_idx = geom.vb_size[g_curFBIdx];
+	if (cur_vb_idx + count > geom.max_vertices) {
+		return nullptr;
+	}
+
+	const PipelineBlend blend = (LineFlags & LINE_Transparent) ? kPipeBlendTranslucent : kPipeBlendNo;
+	const bool b_depth_test = 0 != (LineFlags & LINE_DepthCued);
+
+	BufferView<UEPerDrawCallGouraudVsData> vs_uniforms(
+		g_ue_gouraud_vs_ub->buf[g_curFBIdx]->getMappedPtr(), g_ue_gouraud_vs_ub->el_size,
+		g_ue_gouraud_vs_ub->num_el);
+
+	ComplexSurfaceDrawCall* batch = g_draw_calls.empty() ? nullptr : &g_draw_calls.back();
+	if (batch && batch->surface_shader == shader && batch->pipeline_blend == blend &&
+		batch->b_depth_test == b_depth_test &&
+		batch->viewport_idx == g_current_viewport_idx &&
+		0 == memcmp(&vs_uniforms[batch->vs_ub_idx].proj, &g_current_projection, sizeof(mat4))) {
+		assert(batch->vb_offset + batch->num_vertices == cur_vb_idx);
+		batch->num_vertices += count;
+	} else {
+		uint32_t& cur_vs_data_idx = g_ue_gouraud_vs_ub->size[g_curFBIdx];
+		vs_uniforms[cur_vs_data_idx++].proj = g_current_projection;
+
+		ComplexSurfaceDrawCall dc;
+		dc.pipeline_blend = blend;
+		dc.b_depth_write = false;
+		dc.b_alpha_test = false;
+		dc.b_depth_test = b_depth_test;
+		dc.surface_shader = shader;
+		dc.b_static_geom = false;
+		dc.vb_offset = cur_vb_idx;
+		dc.num_vertices = count;
+		dc.ib_offset = 0;
+		dc.num_indices = 0;
+		dc.diffuse = nullptr;
+		dc.detail = nullptr;
+		dc.lightmap = nullptr;
+		dc.macro = nullptr;
+		dc.diffuse_index = nullptr;
+		dc.vs_ub_idx = cur_vs_data_idx - 1;
+		dc.viewport_idx = g_current_viewport_idx;
+		// needed to bind VS uniforms, texture slot stays empty
+		if (g_ue_gouraud_dsets[g_curFBIdx].size() == (size_t)g_ue_gouraud_dsets_reserved[g_curFBIdx]) {
+			g_ue_gouraud_dsets[g_curFBIdx].push_back(
+				g_vulkan_device->AllocateDescriptorSet(g_ue_dsl_gouraud));
+		}
+		dc.dset = g_ue_gouraud_dsets[g_curFBIdx][g_ue_gouraud_dsets_reserved[g_curFBIdx]];
+		g_ue_gouraud_dsets_reserved[g_curFBIdx]++;
+		g_draw_calls.emplace_back(dc);
+	}
+
+	UEVertexLine* VB = g_ue_geom->vertices<UEVertexLine>(kGeomStreamLine, g_curFBIdx) + cur_vb_idx;
+	cur_vb_idx += count;
+	return VB;
+}
+
 void UVulkanRenderDevice::Draw2DLine(FSceneNode* Frame, FPlane Color, DWORD LineFlags, FVector P1, FVector P2)
 {
+	UEVertexLine* v = ue_alloc_line_vertices(kSurfaceShaderLine, LineFlags, 2);
+	if (!v) {
+		log_error("Draw2DLine: line vertex buffer is full\n");
+		return;
+	}
+
+	const DWORD color = FPlaneTo_BGRClamped_A255(&Color);
+	v[0].Pos = ue_screen_to_view(Frame, m_RFX2, m_RFY2, P1.X, P1.Y, P1.Z);
+	v[0].Color = color;
+	v[1].Pos = ue_screen_to_view(Frame, m_RFX2, m_RFY2, P2.X, P2.Y, P2.Z);
+	v[1].Color = color;
 }
 void UVulkanRenderDevice::Draw2DPoint(FSceneNode* Frame, FPlane Color, DWORD LineFlags, FLOAT X1, FLOAT Y1, FLOAT X2, FLOAT Y2, FLOAT Z)
 {
+	UEVertexLine* v = ue_alloc_line_vertices(kSurfaceShaderPoint, LineFlags, 6);
+	if (!v) {
+		log_error("Draw2DPoint: line vertex buffer is full\n");
+		return;
+	}
+
+	// point is a rectangle, expanded by half a pixel around the centres of its corner pixels, same as
+	// D3D renderers do, so that it covers at least one pixel
+	const DWORD color = FPlaneTo_BGRClamped_A255(&Color);
+	const vec3 p0 = ue_screen_to_view(Frame, m_RFX2, m_RFY2, X1 - 0.5f, Y1 - 0.5f, Z);
+	const vec3 p1 = ue_screen_to_view(Frame, m_RFX2, m_RFY2, X2 + 0.5f, Y1 - 0.5f, Z);
+	const vec3 p2 = ue_screen_to_view(Frame, m_RFX2, m_RFY2, X2 + 0.5f, Y2 + 0.5f, Z);
+	const vec3 p3 = ue_screen_to_view(Frame, m_RFX2, m_RFY2, X1 - 0.5f, Y2 + 0.5f, Z);
+	const vec3 quad[6] = { p0, p1, p2, p0, p2, p3 };
+	for (int i = 0; i < 6; ++i) {
+		v[i].Pos = quad[i];
+		v[i].Color = color;
+	}
 }
 void UVulkanRenderDevice::ClearZ(FSceneNode* Frame)
 {
@@ -2438,16 +4824,20 @@ void UVulkanRenderDevice::ClearZ(FSceneNode* Frame)
 	//dc.b_depth_clear = true;
 	dc.b_alpha_test = false;
 	dc.surface_shader = kSurfaceShaderClearDepth;
+	dc.b_depth_test = true;
+	dc.b_static_geom = false;
 
-	dc.viewport = g_current_viewport;
+	dc.viewport_idx = g_current_viewport_idx;
+	// recorded as ClearAttachments, not drawn
 	dc.vb_offset = 0;
-	dc.num_vertices = 6;
+	dc.num_vertices = 0;
 	dc.ib_offset = 0;
 	dc.num_indices = 0;
 	dc.diffuse = nullptr;
 	dc.lightmap = nullptr;
 	dc.detail = nullptr;
 	dc.macro = nullptr;
+	dc.diffuse_index = nullptr;
 	dc.dset = nullptr;
 	g_draw_calls.emplace_back(dc);
 
@@ -2461,11 +4851,137 @@ void UVulkanRenderDevice::PopHit(INT Count, UBOOL bForce)
 }
 void UVulkanRenderDevice::GetStats(TCHAR* Result)
 {
+	if (g_gpu_timer) {
+		appSprintf(Result, TEXT("GPU frame %.2f ms, depth pre-pass %s %.2f ms, surface cache %s"),
+				   g_gpu_timer->frame_ms, options.depthPrepass ? TEXT("on") : TEXT("off"),
+				   g_gpu_timer->prepass_ms, options.surfaceCache ? TEXT("on") : TEXT("off"));
+	}
+	if (g_ue_surface_cache && options.surfaceCache) {
+		TCHAR* end = Result + appStrlen(Result);
+		appSprintf(end, TEXT("%s%d tiles, %d built, %d drawn, %d pages evicted"),
+				   end == Result ? TEXT("") : TEXT(": "), (int)g_ue_surface_cache->tiles.size(),
+				   g_ue_surface_cache->num_built, g_ue_surface_cache->num_drawn,
+				   g_ue_surface_cache->num_evicted);
+	}
+	if (g_ue_lightmap_atlas && options.lightmapAtlas) {
+		TCHAR* end = Result + appStrlen(Result);
+		appSprintf(end, TEXT("%slightmap atlas %d tiles, %d uploaded, %d pages evicted"),
+				   end == Result ? TEXT("") : TEXT(", "), (int)g_ue_lightmap_atlas->tiles.size(),
+				   g_ue_lightmap_atlas->num_uploaded, g_ue_lightmap_atlas->num_evicted);
+	}
+	if (g_ue_world_cache) {
+		TCHAR* end = Result + appStrlen(Result);
+		appSprintf(end, TEXT("%sworld cache %d polys, %d pages evicted"), end == Result ? TEXT("") : TEXT(", "),
+				   (int)g_ue_world_cache->polys.size(), g_ue_world_cache->num_evicted);
+	}
+	if (g_ue_tex_expander && g_ue_tex_expander->num_expanded) {
+		TCHAR* end = Result + appStrlen(Result);
+		appSprintf(end, TEXT("%s%d textures expanded on GPU in %d batches"), end == Result ? TEXT("") : TEXT(", "),
+				   g_ue_tex_expander->num_expanded, g_ue_tex_expander->num_batches);
+	}
 }
 void UVulkanRenderDevice::ReadPixels(FColor* Pixels)
 {
 }
 
+/**
+CPU cost of producing fans in every fan mode: fan indices and the indirect draw record each fan
+gets (see ue_write_indirect_commands()), on the same pseudo random fan sizes as world and meshes
+usually have. Table mode writes no indices but still pays for records. Run with "BenchFans" console
+command.
+*/
+static void ue_bench_fan_modes(FOutputDevice& Ar) {
+	const uint32_t num_fans = 1024 * 1024;
+	std::vector<uint32_t> scratch(gUENumIndices);
+	std::vector<RHIDrawIndexedIndirectCommand> cmds(gUEIndirectDraws);
+	const TCHAR* const names[kFanModeCount] = { TEXT("cpu list"), TEXT("native fan"), TEXT("fan table") };
+
+	for (int mode = 0; mode < kFanModeCount; ++mode) {
+		uint32_t seed = 12345;
+		uint32_t pos = 0;
+		uint32_t first_vert = 0;
+		uint32_t cmd = 0;
+		uint64_t total_indices = 0;
+
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		for (uint32_t i = 0; i < num_fans; ++i) {
+			seed = seed * 1664525 + 1013904223;
+			const uint32_t num_verts = 3 + ((seed >> 16) % 14);
+			if (pos + 3 * num_verts >= gUENumIndices)
+				pos = 0;
+			if (cmd == gUEIndirectDraws)
+				cmd = 0;
+			const uint32_t written =
+				ue_emit_fan_indices((FanMode)mode, scratch.data() + pos, first_vert, num_verts);
+			RHIDrawIndexedIndirectCommand& c = cmds[cmd++];
+			c.indexCount = ue_fan_draw_index_count((FanMode)mode, num_verts, written);
+			c.instanceCount = 1;
+			c.firstIndex = kFanModeTable == mode ? 0 : pos;
+			c.vertexOffset = kFanModeTable == mode ? (int32_t)first_vert : 0;
+			c.firstInstance = 0;
+			pos += written;
+			first_vert += num_verts;
+			total_indices += written;
+		}
+		QueryPerformanceCounter(&end);
+
+		const double ms = 1000.0 * (double)(end.QuadPart - start.QuadPart) / (double)perfCounterFreq.QuadPart;
+		log_info("BenchFans: mode %d: %u fans, %.3f ms, %llu index bytes\n", mode, num_fans, ms,
+				 total_indices * sizeof(uint32_t));
+		Ar.Logf(TEXT("%s: %.3f ms, %d KB of indices"), names[mode], ms,
+				(INT)(total_indices * sizeof(uint32_t) / 1024));
+	}
+	// keeps records alive, so that compiler can not drop their writes
+	uint32_t check = 0;
+	for (size_t i = 0; i < cmds.size(); ++i) {
+		check += cmds[i].indexCount;
+	}
+	log_info("BenchFans: checksum %u\n", check);
+}
+
+/**
+P8 texture expansion cost of the plain per pixel loop vs. runtime dispatched (SIMD if available)
+one, on a 1024x1024 texture with random indices. Run with "BenchPalette" console command.
+*/
+static void ue_bench_palette_expand(FOutputDevice& Ar) {
+	const uint32_t num_pixels = 1024 * 1024;
+	const int num_iterations = 16;
+	std::vector<BYTE> src(num_pixels);
+	std::vector<DWORD> dst[2] = { std::vector<DWORD>(num_pixels), std::vector<DWORD>(num_pixels) };
+	DWORD palette[256];
+
+	uint32_t seed = 12345;
+	for (int i = 0; i < 256; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		palette[i] = seed;
+	}
+	for (uint32_t i = 0; i < num_pixels; ++i) {
+		seed = seed * 1664525 + 1013904223;
+		src[i] = (BYTE)(seed >> 24);
+	}
+
+	const PaletteExpandFunc funcs[2] = { getPaletteExpandFunc(false), getPaletteExpandFunc(true) };
+	const TCHAR* const names[2] = { TEXT("scalar"), TEXT("dispatched") };
+	for (int f = 0; f < 2; ++f) {
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		for (int i = 0; i < num_iterations; ++i) {
+			funcs[f](palette, src.data(), dst[f].data(), num_pixels);
+		}
+		QueryPerformanceCounter(&end);
+
+		const double ms = 1000.0 * (double)(end.QuadPart - start.QuadPart) /
+						  (double)perfCounterFreq.QuadPart / num_iterations;
+		log_info("BenchPalette: %s: %.3f ms per 1024x1024 texture\n", f ? "dispatched" : "scalar", ms);
+		Ar.Logf(TEXT("%s: %.3f ms per 1024x1024 texture"), names[f], ms);
+	}
+
+	const bool same = 0 == memcmp(dst[0].data(), dst[1].data(), num_pixels * sizeof(DWORD));
+	Ar.Logf(TEXT("%s%s"), funcs[0] == funcs[1] ? TEXT("no AVX2, both use scalar path, ") : TEXT(""),
+			same ? TEXT("results match") : TEXT("results DIFFER"));
+}
+
 /* Optional but implemented */
 
 UBOOL UVulkanRenderDevice::Exec(const TCHAR* Cmd, FOutputDevice& Ar)
@@ -2479,7 +4995,48 @@ UBOOL UVulkanRenderDevice::Exec(const TCHAR* Cmd, FOutputDevice& Ar)
 	}
 	else
 	#endif
-	if(ParseCommand(&Cmd,L"GetRes"))
+	if(ParseCommand(&Cmd,L"BenchFans"))
+	{
+		ue_bench_fan_modes(Ar);
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"BenchPalette"))
+	{
+		ue_bench_palette_expand(Ar);
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"DepthPrepass"))
+	{
+		options.depthPrepass = !options.depthPrepass;
+		Ar.Logf(TEXT("Depth pre-pass %s"), options.depthPrepass ? TEXT("on") : TEXT("off"));
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"SurfaceCache"))
+	{
+		options.surfaceCache = !options.surfaceCache;
+		Ar.Logf(TEXT("Surface cache %s"), options.surfaceCache ? TEXT("on") : TEXT("off"));
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"LightmapAtlas"))
+	{
+		options.lightmapAtlas = !options.lightmapAtlas;
+		Ar.Logf(TEXT("Lightmap atlas %s"), options.lightmapAtlas ? TEXT("on") : TEXT("off"));
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"PalettedTextures"))
+	{
+		options.palettedTextures = !options.palettedTextures;
+		Ar.Logf(TEXT("Paletted textures %s"), options.palettedTextures ? TEXT("on") : TEXT("off"));
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"GpuStats"))
+	{
+		TCHAR stats[256] = TEXT("No GPU timing stats");
+		GetStats(stats);
+		Ar.Log(stats);
+		return 1;
+	}
+	else if(ParseCommand(&Cmd,L"GetRes"))
 	{
 		log_info("Getting modelist...\n");
 		TCHAR* resolutions = TEXT("ASFAS");// D3D::getModes();
@@ -2533,12 +5090,14 @@ void UVulkanRenderDevice::SetSceneNode(FSceneNode* Frame)
 	}
 	#endif
 
-	g_current_viewport.x =  Frame->XB;
-	g_current_viewport.y =  Frame->YB;
-	g_current_viewport.width = Frame->X;
-	g_current_viewport.height = Frame->Y;
-	g_current_viewport.minDepth = 0.0f;
-	g_current_viewport.maxDepth = 1.0f;
+	RHIViewport viewport;
+	viewport.x =  Frame->XB;
+	viewport.y =  Frame->YB;
+	viewport.width = Frame->X;
+	viewport.height = Frame->Y;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	ue_set_current_viewport(viewport);
 
 	// Viewport is set here as it changes during gameplay. For example in DX conversations
  	//D3D::setViewPort(Frame->X,Frame->Y,Frame->XB,Frame->YB); 
@@ -2558,6 +5117,26 @@ Store a texture in the renderer-kept texture cache. Only called by the game if U
 */
 void UVulkanRenderDevice::PrecacheTexture(FTextureInfo& Info, DWORD PolyFlags)
 {
+	if (!g_precache_batch.num_textures) {
+		QueryPerformanceCounter(&g_precache_batch.start);
+		log_info("Precache: started\n");
+	}
+	g_precache_batch.num_textures++;
+	// same cache DrawComplexSurface picks for diffuse, engine precaches world textures with
+	// their surface flags
+	TextureCache* cache = IsPalettedDiffuse(Info, PolyFlags) ? g_texCachePaletted : g_texCache;
+	if (cache->isCached(Info.CacheID) && !Info.bRealtimeChanged) {
+		g_precache_batch.num_skipped++;
+		return;
+	}
+
+	// paletted textures go to conversion workers, the rest is converted right away, uploads wait
+	// for Unlock either way
+	ue_get_cached_texture(cache, &Info, PolyFlags, g_vulkan_device, false);
+
+	if ((g_precache_batch.num_textures & 255) == 0) {
+		log_info("Precache: %d textures queued\n", g_precache_batch.num_textures);
+	}
 }
 void UVulkanRenderDevice::EndFlash()
 {
@@ -47,6 +47,16 @@ private:
 		int FPSLimit; /**< 60FPS frame limiter */
 		int unlimitedViewDistance; /**< Set frustum to max map size */
 		UBOOL ColorizeDetailTextures;
+		int fanMode; /**< How polygon fans are submitted: 0 - CPU triangle lists, 1 - native fans, 2 - precomputed fan index table */
+		UBOOL staticWorldCache; /**< Keep BSP geometry in GPU memory across frames */
+		UBOOL depthPrepass; /**< Lay down depth of opaque world surfaces before shading them, can be toggled at runtime */
+		UBOOL twoPhaseMasked; /**< Draw masked surfaces as alpha tested depth and then colour with EQUAL depth test, can be toggled at runtime */
+		UBOOL surfaceCache; /**< Draw lightmapped world surfaces from an atlas of precombined diffuse and lightmap, can be toggled at runtime */
+		UBOOL lightmapAtlas; /**< Pack static lightmaps into a few big atlas pages instead of a texture each, can be toggled at runtime */
+		UBOOL asyncTextureConversion; /**< Convert new paletted textures on worker threads and show a placeholder until they are ready */
+		UBOOL diskTextureCache; /**< Keep converted paletted textures in a pack file between runs and load them from there instead of converting */
+		UBOOL palettedTextures; /**< Keep paletted world textures as 8 bit indices and look palette up in the shader, can be toggled at runtime */
+		int gpuTextureExpansion; /**< Expand paletted textures in a compute shader at upload: 0 - off, 1 - on, 2 - on and compare results with CPU conversion */
 	} options;
 
 	DWORD m_detailTextureColor4ub; 
@@ -64,6 +74,7 @@ private:
 
 	void SetProjection(bool requestNearZRangeHackProjection);
 	void SetOrthoProjection(void);
+	bool IsPalettedDiffuse(const FTextureInfo& Texture, DWORD PolyFlags) const;
 public:
 	UVulkanRenderDevice();
 